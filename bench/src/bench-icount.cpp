@@ -0,0 +1,113 @@
+// Fixed workload for the instruction count benchmark (scripts/icount.py).
+// Runs one case a given number of times, so that the counts of a run with N and 2N
+// iterations differ by exactly N iterations of the case.
+#include "bench-util.hpp"
+
+namespace {
+
+/** Message size of the mode cases (256 blocks). */
+const unsigned long kMessageSize = 4096;
+
+void print_usage() {
+    printf(
+        "usage: bench_icount CASE ITERATIONS\n"
+        "       bench_icount --list | --info\n"
+        "CASE is key_setup-BITS, or MODE-OP-BITS with MODE-OP in ecb-encrypt, ecb-decrypt,\n"
+        "cbc-encrypt, cbc-decrypt, ctr-crypt and BITS in 128, 192, 256.\n");
+}
+
+void list_cases() {
+    const char *const ops[] = {"key_setup", "ecb-encrypt", "ecb-decrypt", "cbc-encrypt", "cbc-decrypt", "ctr-crypt"};
+    const int bits[] = {128, 192, 256};
+    for (std::size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i) {
+        for (std::size_t k = 0; k < sizeof(bits) / sizeof(bits[0]); ++k) {
+            printf("%s-%d %lu\n", ops[i], bits[k], i == 0 ? 16UL : kMessageSize / 16);
+        }
+    }
+}
+
+} // no namespace
+
+int main(int argc, char **argv) {
+    if (argc == 2 && std::string(argv[1]) == "--list") {
+        // case and the number of units (key setups or blocks) per iteration
+        list_cases();
+        return 0;
+    }
+    if (argc == 2 && std::string(argv[1]) == "--info") {
+        printf("version %08x\n", plusaes::version());
+        printf("backend %s\n", plusaes::backend_name(plusaes::active_backend()));
+#if defined(__VERSION__)
+        printf("compiler %s\n", __VERSION__);
+#endif
+        return 0;
+    }
+    if (argc != 3) {
+        print_usage();
+        return 2;
+    }
+
+    const std::string name = argv[1];
+    const long iterations = atol(argv[2]);
+    const std::string::size_type dash = name.rfind('-');
+    if (dash == std::string::npos || iterations < 0) {
+        print_usage();
+        return 2;
+    }
+    const std::string op = name.substr(0, dash);
+    const unsigned long key_size = static_cast<unsigned long>(atoi(name.c_str() + dash + 1) / 8);
+    if (!plusaes::detail::is_valid_key_size(key_size)) {
+        print_usage();
+        return 2;
+    }
+
+    const std::vector<unsigned char> key = bench::make_bytes(32, 2);
+    const std::vector<unsigned char> in = bench::make_bytes(kMessageSize, 1);
+    std::vector<unsigned char> out(kMessageSize);
+    const unsigned char iv[16] = {};
+    const plusaes::KeySchedule ks(&key[0], key_size);
+
+    volatile unsigned char sink = 0;
+    if (op == "key_setup") {
+        // 16 setups per iteration, as many as the unit count of --list
+        for (long i = 0; i < iterations * 16; ++i) {
+            const plusaes::KeySchedule k(&key[0], key_size);
+            sink = sink ^ static_cast<unsigned char>(k.round_keys()[1][0]);
+        }
+    }
+    else if (op == "ecb-encrypt") {
+        for (long i = 0; i < iterations; ++i) {
+            plusaes::encrypt_ecb(&in[0], kMessageSize, ks, &out[0], kMessageSize, false);
+        }
+    }
+    else if (op == "ecb-decrypt") {
+        for (long i = 0; i < iterations; ++i) {
+            plusaes::decrypt_ecb(&in[0], kMessageSize, ks, &out[0], kMessageSize, 0);
+        }
+    }
+    else if (op == "cbc-encrypt") {
+        for (long i = 0; i < iterations; ++i) {
+            plusaes::encrypt_cbc(&in[0], kMessageSize, ks, &iv, &out[0], kMessageSize, false);
+        }
+    }
+    else if (op == "cbc-decrypt") {
+        for (long i = 0; i < iterations; ++i) {
+            plusaes::decrypt_cbc(&in[0], kMessageSize, ks, &iv, &out[0], kMessageSize, 0);
+        }
+    }
+    else if (op == "ctr-crypt") {
+        for (long i = 0; i < iterations; ++i) {
+            plusaes::crypt_ctr(&out[0], kMessageSize, ks, iv, sizeof(iv));
+        }
+    }
+    else {
+        print_usage();
+        return 2;
+    }
+
+    // keeps the results alive
+    for (unsigned long i = 0; i < out.size(); ++i) {
+        sink = sink ^ out[i];
+    }
+    return 0;
+}
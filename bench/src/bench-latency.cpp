@@ -0,0 +1,289 @@
+// Latency benchmark: percentiles of single calls on small messages, with warm and cold caches.
+#include "bench-util.hpp"
+
+namespace {
+
+struct Options {
+    std::vector<std::string> ops;
+    std::vector<std::string> sizes;
+    unsigned long samples;
+    unsigned long cold_samples;
+    unsigned long long evict_size;
+    bool histogram;
+    std::string backend;
+    std::string json;
+};
+
+/** Percentiles of the distribution table, as in HdrHistogram's percentile output. */
+const double kPercentiles[] = {0, 10, 25, 50, 75, 90, 95, 99, 99.5, 99.9, 99.95, 99.99, 100};
+
+struct Result {
+    std::string op;
+    std::string key;   // "schedule" (KeySchedule) or "raw" (key bytes: key expansion in each call)
+    std::string cache; // "warm" or "cold"
+    unsigned long size;
+    /** Sorted latencies in nanoseconds. */
+    std::vector<double> ns;
+
+    double percentile(const double p) const {
+        const std::size_t i = static_cast<std::size_t>(p / 100 * static_cast<double>(ns.size() - 1) + 0.5);
+        return ns[i];
+    }
+};
+
+void print_usage() {
+    printf(
+        "usage: bench_latency [options]\n"
+        "  --op LIST          cbc-encrypt,cbc-decrypt,ctr (default: all)\n"
+        "  --size LIST        message sizes (default: 32,64,128,256,512)\n"
+        "  --samples N        calls per warm case (default: 100000)\n"
+        "  --cold-samples N   calls per cold case (default: 2000)\n"
+        "  --evict-size N     buffer swept before each cold call (default: 64M)\n"
+        "  --histogram on|off print the percentile distribution of each case (default: off)\n"
+        "  --backend NAME     force a backend (reference, ttable, bitslice, vperm, aesni, vaes)\n"
+        "  --json FILE        write the percentiles as JSON\n"
+        "Each case runs with a KeySchedule and with the raw key, whose calls expand the key.\n");
+}
+
+bool parse_options(int argc, char **argv, Options &opts) {
+    opts.ops = bench::split("cbc-encrypt,cbc-decrypt,ctr");
+    opts.sizes = bench::split("32,64,128,256,512");
+    opts.samples = 100000;
+    opts.cold_samples = 2000;
+    opts.evict_size = 64ULL << 20;
+    opts.histogram = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char *v = argv[++i];
+        if (arg == "--op") {
+            opts.ops = bench::split(v);
+        }
+        else if (arg == "--size") {
+            opts.sizes = bench::split(v);
+        }
+        else if (arg == "--samples") {
+            opts.samples = strtoul(v, 0, 10);
+        }
+        else if (arg == "--cold-samples") {
+            opts.cold_samples = strtoul(v, 0, 10);
+        }
+        else if (arg == "--evict-size") {
+            opts.evict_size = bench::parse_size(v);
+        }
+        else if (arg == "--histogram") {
+            opts.histogram = std::string(v) == "on";
+        }
+        else if (arg == "--backend") {
+            opts.backend = v;
+        }
+        else if (arg == "--json") {
+            opts.json = v;
+        }
+        else {
+            return false;
+        }
+    }
+    return opts.samples > 0 && opts.cold_samples > 0;
+}
+
+/** Time stamp counter, ordered with the surrounding instructions. */
+inline uint64_t fenced_tsc() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    const uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+#else
+    return bench::now_ns();
+#endif
+}
+
+/** Nanoseconds per fenced_tsc() tick. */
+double calibrate_tick_ns() {
+    if (!bench::has_tsc()) {
+        return 1;
+    }
+    const uint64_t t0 = bench::now_ns();
+    const uint64_t c0 = fenced_tsc();
+    while (bench::now_ns() - t0 < 100000000) {
+    }
+    const uint64_t t1 = bench::now_ns();
+    const uint64_t c1 = fenced_tsc();
+    return static_cast<double>(t1 - t0) / static_cast<double>(c1 - c0);
+}
+
+/** Smallest fenced_tsc() difference of back-to-back reads, subtracted from the samples. */
+uint64_t timer_overhead() {
+    uint64_t best = ~static_cast<uint64_t>(0);
+    for (int i = 0; i < 10000; ++i) {
+        const uint64_t t0 = fenced_tsc();
+        const uint64_t t1 = fenced_tsc();
+        best = std::min(best, t1 - t0);
+    }
+    return best;
+}
+
+/** Sweeps the eviction buffer, so that the next call finds the tables and the key schedule out of the caches. */
+void evict(std::vector<unsigned char> &buf) {
+    volatile unsigned char *p = &buf[0];
+    for (std::size_t i = 0; i < buf.size(); i += 64) {
+        p[i] = static_cast<unsigned char>(p[i] + 1);
+    }
+}
+
+void print_result(const Result &r, const bool histogram) {
+    printf("%-12s %-8s %-4s %4lu B  p50 %8.0f  p90 %8.0f  p99 %8.0f  p999 %8.0f  max %9.0f ns\n",
+        r.op.c_str(), r.key.c_str(), r.cache.c_str(), r.size,
+        r.percentile(50), r.percentile(90), r.percentile(99), r.percentile(99.9), r.ns.back());
+    if (histogram) {
+        printf("  %12s %12s %10s %14s\n", "Value(ns)", "Percentile", "TotalCount", "1/(1-Percentile)");
+        for (std::size_t i = 0; i < sizeof(kPercentiles) / sizeof(kPercentiles[0]); ++i) {
+            const double p = kPercentiles[i];
+            const unsigned long count = static_cast<unsigned long>(p / 100 * static_cast<double>(r.ns.size()) + 0.5);
+            if (p < 100) {
+                printf("  %12.1f %12.6f %10lu %14.2f\n", r.percentile(p), p / 100, count, 1 / (1 - p / 100));
+            }
+            else {
+                printf("  %12.1f %12.6f %10lu %14s\n", r.percentile(p), p / 100, count, "inf");
+            }
+        }
+    }
+    fflush(stdout);
+}
+
+void write_json(const std::string &path, const double tick_ns, const std::vector<Result> &results) {
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp) {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return;
+    }
+
+    bench::JsonWriter w(fp);
+    w.begin_object();
+    char version[16];
+    snprintf(version, sizeof(version), "%08x", plusaes::version());
+    w.value("version", version);
+    w.value("backend", plusaes::backend_name(plusaes::active_backend()));
+    w.value("tick_ns", tick_ns);
+    w.begin_array("results");
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        w.begin_object();
+        w.value("op", r.op);
+        w.value("key", r.key);
+        w.value("cache", r.cache);
+        w.value("size", r.size);
+        w.value("samples", static_cast<unsigned long>(r.ns.size()));
+        w.begin_object("percentiles_ns");
+        for (std::size_t j = 0; j < sizeof(kPercentiles) / sizeof(kPercentiles[0]); ++j) {
+            char name[16];
+            snprintf(name, sizeof(name), "p%g", kPercentiles[j]);
+            w.value(name, r.percentile(kPercentiles[j]));
+        }
+        w.end_object();
+        w.end_object();
+    }
+    w.end_array();
+    w.end_object();
+    fclose(fp);
+}
+
+} // no namespace
+
+int main(int argc, char **argv) {
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        print_usage();
+        return 2;
+    }
+    if (!opts.backend.empty() && !bench::select_backend(opts.backend)) {
+        fprintf(stderr, "unsupported backend: %s\n", opts.backend.c_str());
+        return 2;
+    }
+
+    const double tick_ns = calibrate_tick_ns();
+    const uint64_t overhead = timer_overhead();
+    printf("plusaes %08x, backend %s, timer overhead %.1f ns (subtracted)\n",
+        plusaes::version(), plusaes::backend_name(plusaes::active_backend()), static_cast<double>(overhead) * tick_ns);
+
+    const std::vector<unsigned char> key = bench::make_bytes(16, 2);
+    const plusaes::KeySchedule ks(&key[0], static_cast<unsigned long>(key.size()));
+    const unsigned char iv[16] = {};
+    std::vector<unsigned char> evict_buf(static_cast<std::size_t>(opts.evict_size) + 64);
+
+    std::vector<Result> results;
+    for (std::size_t o = 0; o < opts.ops.size(); ++o) {
+        const std::string &op = opts.ops[o];
+        if (op != "cbc-encrypt" && op != "cbc-decrypt" && op != "ctr") {
+            fprintf(stderr, "unknown op: %s\n", op.c_str());
+            return 2;
+        }
+        for (std::size_t s = 0; s < opts.sizes.size(); ++s) {
+            const unsigned long size = static_cast<unsigned long>(bench::parse_size(opts.sizes[s].c_str()));
+            if (size == 0 || (op != "ctr" && size % 16 != 0)) {
+                fprintf(stderr, "invalid size for %s: %s\n", op.c_str(), opts.sizes[s].c_str());
+                return 2;
+            }
+            const std::vector<unsigned char> in = bench::make_bytes(size, 1);
+            std::vector<unsigned char> out(size);
+
+            for (int raw = 0; raw < 2; ++raw) {
+                for (int cold = 0; cold < 2; ++cold) {
+                    Result r;
+                    r.op = op;
+                    r.key = raw ? "raw" : "schedule";
+                    r.cache = cold ? "cold" : "warm";
+                    r.size = size;
+
+                    const unsigned long n = cold ? opts.cold_samples : opts.samples;
+                    r.ns.reserve(n);
+                    for (unsigned long i = 0; i < n; ++i) {
+                        if (cold) {
+                            evict(evict_buf);
+                        }
+                        const uint64_t t0 = fenced_tsc();
+                        if (op == "cbc-encrypt") {
+                            if (raw) {
+                                plusaes::encrypt_cbc(&in[0], size, &key[0], 16, &iv, &out[0], size, false);
+                            }
+                            else {
+                                plusaes::encrypt_cbc(&in[0], size, ks, &iv, &out[0], size, false);
+                            }
+                        }
+                        else if (op == "cbc-decrypt") {
+                            if (raw) {
+                                plusaes::decrypt_cbc(&in[0], size, &key[0], 16, &iv, &out[0], size, 0);
+                            }
+                            else {
+                                plusaes::decrypt_cbc(&in[0], size, ks, &iv, &out[0], size, 0);
+                            }
+                        }
+                        else {
+                            if (raw) {
+                                plusaes::crypt_ctr(&out[0], size, &key[0], 16, iv, sizeof(iv));
+                            }
+                            else {
+                                plusaes::crypt_ctr(&out[0], size, ks, iv, sizeof(iv));
+                            }
+                        }
+                        const uint64_t t1 = fenced_tsc();
+                        const uint64_t ticks = t1 - t0;
+                        r.ns.push_back(static_cast<double>(ticks > overhead ? ticks - overhead : 0) * tick_ns);
+                    }
+                    std::sort(r.ns.begin(), r.ns.end());
+                    print_result(r, opts.histogram);
+                    results.push_back(r);
+                }
+            }
+        }
+    }
+
+    if (!opts.json.empty()) {
+        write_json(opts.json, tick_ns, results);
+    }
+    return 0;
+}
@@ -0,0 +1,370 @@
+// Multi-thread scaling benchmark: aggregate throughput of N threads calling the mode APIs at once.
+#include "bench-util.hpp"
+
+#include <atomic>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+struct Options {
+    std::vector<std::string> ops;
+    std::vector<std::string> keys;
+    std::vector<unsigned> threads;
+    unsigned long size;
+    unsigned long key_bytes;
+    double time;
+    bool pin;
+    std::string backend;
+    std::string json;
+};
+
+/** Threads within this fraction of the peak throughput are at the saturation point. */
+const double kSaturation = 0.95;
+
+struct Result {
+    std::string op;
+    std::string keys; // "private" (a KeySchedule per thread) or "shared" (one KeySchedule for all threads)
+    unsigned threads;
+    /** Aggregate throughput in MB/s. */
+    double mb_per_s;
+    /** Throughput of the slowest and the fastest thread in MB/s. */
+    double thread_min;
+    double thread_max;
+    /** mb_per_s / (threads * throughput per thread at the smallest thread count). */
+    double efficiency;
+};
+
+/** Shared state of the threads of a run. */
+struct Run {
+    const Options *opts;
+    const std::string *op;
+    const plusaes::KeySchedule *shared_key; // null for private keys
+    std::vector<unsigned char> key;
+    std::atomic<unsigned> ready;
+    std::atomic<bool> start;
+    std::atomic<bool> stop;
+    uint64_t start_ns;
+};
+
+/** Bytes and the time a thread processed, for the throughput of the thread. */
+struct ThreadResult {
+    unsigned long long bytes;
+    uint64_t end_ns;
+};
+
+std::vector<unsigned> default_threads() {
+    const unsigned n = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> threads;
+    for (unsigned t = 1; t < n; t *= 2) {
+        threads.push_back(t);
+    }
+    threads.push_back(n);
+    return threads;
+}
+
+void print_usage() {
+    printf(
+        "usage: bench_scaling [options]\n"
+        "  --op LIST        ecb-encrypt,ecb-decrypt,cbc-encrypt,cbc-decrypt,ctr (default: all)\n"
+        "  --keys LIST      private,shared (default: both)\n"
+        "  --threads LIST   thread counts (default: 1, 2, 4, ... up to the number of CPUs)\n"
+        "  --size N         message size of each call (default: 64K)\n"
+        "  --key BITS       128, 192 or 256 (default: 128)\n"
+        "  --time SECONDS   duration of each run (default: 0.5)\n"
+        "  --pin on|off     bind thread i to the i-th allowed CPU (Linux, default: off)\n"
+        "  --backend NAME   force a backend (reference, ttable, bitslice, vperm, aesni, vaes)\n"
+        "  --json FILE      write the results as JSON\n");
+}
+
+bool parse_options(int argc, char **argv, Options &opts) {
+    opts.ops = bench::split("ecb-encrypt,ecb-decrypt,cbc-encrypt,cbc-decrypt,ctr");
+    opts.keys = bench::split("private,shared");
+    opts.threads = default_threads();
+    opts.size = 64 * 1024;
+    opts.key_bytes = 16;
+    opts.time = 0.5;
+    opts.pin = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char *v = argv[++i];
+        if (arg == "--op") {
+            opts.ops = bench::split(v);
+        }
+        else if (arg == "--keys") {
+            opts.keys = bench::split(v);
+        }
+        else if (arg == "--threads") {
+            const std::vector<std::string> items = bench::split(v);
+            opts.threads.clear();
+            for (std::size_t k = 0; k < items.size(); ++k) {
+                const unsigned t = static_cast<unsigned>(strtoul(items[k].c_str(), 0, 10));
+                if (t == 0) {
+                    return false;
+                }
+                opts.threads.push_back(t);
+            }
+        }
+        else if (arg == "--size") {
+            opts.size = static_cast<unsigned long>(bench::parse_size(v));
+        }
+        else if (arg == "--key") {
+            opts.key_bytes = strtoul(v, 0, 10) / 8;
+        }
+        else if (arg == "--time") {
+            opts.time = atof(v);
+        }
+        else if (arg == "--pin") {
+            opts.pin = std::string(v) == "on";
+        }
+        else if (arg == "--backend") {
+            opts.backend = v;
+        }
+        else if (arg == "--json") {
+            opts.json = v;
+        }
+        else {
+            return false;
+        }
+    }
+    return !opts.threads.empty() && opts.size > 0 && opts.size % 16 == 0 && opts.time > 0 &&
+        plusaes::detail::is_valid_key_size(opts.key_bytes);
+}
+
+/** Binds the calling thread to the index-th CPU of the process affinity mask. */
+void pin_thread(const unsigned index) {
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+    const int count = CPU_COUNT(&allowed);
+    int skip = static_cast<int>(index % static_cast<unsigned>(count));
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed) && skip-- == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            return;
+        }
+    }
+#else
+    (void)index;
+#endif
+}
+
+void worker(Run &run, const unsigned index, ThreadResult &result) {
+    if (run.opts->pin) {
+        pin_thread(index);
+    }
+
+    // a private key is expanded by the thread, so that it lives in the memory of the thread's node
+    const unsigned long size = run.opts->size;
+    const plusaes::KeySchedule private_key(&run.key[0], static_cast<unsigned long>(run.key.size()));
+    const plusaes::KeySchedule &ks = run.shared_key ? *run.shared_key : private_key;
+    const std::vector<unsigned char> in = bench::make_bytes(size, index + 1);
+    std::vector<unsigned char> out(size);
+    const unsigned char iv[16] = {};
+    const std::string &op = *run.op;
+
+    ++run.ready;
+    while (!run.start.load()) {
+        std::this_thread::yield();
+    }
+
+    unsigned long long bytes = 0;
+    while (!run.stop.load(std::memory_order_relaxed)) {
+        if (op == "ecb-encrypt") {
+            plusaes::encrypt_ecb(&in[0], size, ks, &out[0], size, false);
+        }
+        else if (op == "ecb-decrypt") {
+            plusaes::decrypt_ecb(&in[0], size, ks, &out[0], size, 0);
+        }
+        else if (op == "cbc-encrypt") {
+            plusaes::encrypt_cbc(&in[0], size, ks, &iv, &out[0], size, false);
+        }
+        else if (op == "cbc-decrypt") {
+            plusaes::decrypt_cbc(&in[0], size, ks, &iv, &out[0], size, 0);
+        }
+        else {
+            plusaes::crypt_ctr(&out[0], size, ks, iv, sizeof(iv));
+        }
+        bytes += size;
+    }
+    result.bytes = bytes;
+    result.end_ns = bench::now_ns();
+}
+
+Result run_threads(const Options &opts, const std::string &op, const std::string &keys, const unsigned threads) {
+    Run run;
+    run.opts = &opts;
+    run.op = &op;
+    run.key = bench::make_bytes(opts.key_bytes, 2);
+    const plusaes::KeySchedule shared_key(&run.key[0], opts.key_bytes);
+    run.shared_key = keys == "shared" ? &shared_key : 0;
+    run.ready = 0;
+    run.start = false;
+    run.stop = false;
+
+    std::vector<ThreadResult> results(threads);
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; ++i) {
+        pool.push_back(std::thread(worker, std::ref(run), i, std::ref(results[i])));
+    }
+    while (run.ready.load() < threads) {
+        std::this_thread::yield();
+    }
+    run.start_ns = bench::now_ns();
+    run.start = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(opts.time));
+    run.stop = true;
+    for (unsigned i = 0; i < threads; ++i) {
+        pool[i].join();
+    }
+
+    Result r;
+    r.op = op;
+    r.keys = keys;
+    r.threads = threads;
+    r.thread_min = 0;
+    r.thread_max = 0;
+    unsigned long long bytes = 0;
+    uint64_t end_ns = run.start_ns;
+    for (unsigned i = 0; i < threads; ++i) {
+        const double mb_per_s = static_cast<double>(results[i].bytes) / static_cast<double>(results[i].end_ns - run.start_ns) * 1e3;
+        r.thread_min = i == 0 ? mb_per_s : std::min(r.thread_min, mb_per_s);
+        r.thread_max = std::max(r.thread_max, mb_per_s);
+        bytes += results[i].bytes;
+        end_ns = std::max(end_ns, results[i].end_ns);
+    }
+    r.mb_per_s = static_cast<double>(bytes) / static_cast<double>(end_ns - run.start_ns) * 1e3;
+    r.efficiency = 1;
+    return r;
+}
+
+/** Smallest thread count within kSaturation of the peak throughput of results[first, last). */
+unsigned saturation_point(const std::vector<Result> &results, const std::size_t first, const std::size_t last) {
+    double peak = 0;
+    for (std::size_t i = first; i < last; ++i) {
+        peak = std::max(peak, results[i].mb_per_s);
+    }
+    unsigned threads = 0;
+    for (std::size_t i = first; i < last; ++i) {
+        if (results[i].mb_per_s >= peak * kSaturation && (threads == 0 || results[i].threads < threads)) {
+            threads = results[i].threads;
+        }
+    }
+    return threads;
+}
+
+void print_result(const Result &r) {
+    printf("%-12s %-8s %4u threads %11.1f MB/s  per thread %9.1f .. %9.1f MB/s  efficiency %5.1f%%\n",
+        r.op.c_str(), r.keys.c_str(), r.threads, r.mb_per_s, r.thread_min, r.thread_max, r.efficiency * 100);
+    fflush(stdout);
+}
+
+void write_json(const std::string &path, const Options &opts, const std::vector<Result> &results,
+    const std::vector<unsigned> &saturation) {
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp) {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return;
+    }
+
+    bench::JsonWriter w(fp);
+    w.begin_object();
+    char version[16];
+    snprintf(version, sizeof(version), "%08x", plusaes::version());
+    w.value("version", version);
+    w.value("backend", plusaes::backend_name(plusaes::active_backend()));
+    w.value("cpus", static_cast<unsigned long>(std::thread::hardware_concurrency()));
+    w.value("size", opts.size);
+    w.value("key_bits", opts.key_bytes * 8);
+    w.value("pin", opts.pin ? "on" : "off");
+    w.begin_array("results");
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        w.begin_object();
+        w.value("op", r.op);
+        w.value("keys", r.keys);
+        w.value("threads", static_cast<unsigned long>(r.threads));
+        w.value("mb_per_s", r.mb_per_s);
+        w.value("thread_mb_per_s_min", r.thread_min);
+        w.value("thread_mb_per_s_max", r.thread_max);
+        w.value("efficiency", r.efficiency);
+        w.value("saturation_threads", static_cast<unsigned long>(saturation[i]));
+        w.end_object();
+    }
+    w.end_array();
+    w.end_object();
+    fclose(fp);
+}
+
+} // no namespace
+
+int main(int argc, char **argv) {
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        print_usage();
+        return 2;
+    }
+    if (!opts.backend.empty() && !bench::select_backend(opts.backend)) {
+        fprintf(stderr, "unsupported backend: %s\n", opts.backend.c_str());
+        return 2;
+    }
+    std::sort(opts.threads.begin(), opts.threads.end());
+    opts.threads.erase(std::unique(opts.threads.begin(), opts.threads.end()), opts.threads.end());
+
+    printf("plusaes %08x, backend %s, %u CPUs, %lu B per call, AES-%lu, pinning %s\n",
+        plusaes::version(), plusaes::backend_name(plusaes::active_backend()), std::thread::hardware_concurrency(),
+        opts.size, opts.key_bytes * 8, opts.pin ? "on" : "off");
+
+    std::vector<Result> results;
+    // saturation point of each result, the same for all thread counts of an op and keys
+    std::vector<unsigned> saturation;
+    for (std::size_t o = 0; o < opts.ops.size(); ++o) {
+        const std::string &op = opts.ops[o];
+        if (op != "ecb-encrypt" && op != "ecb-decrypt" && op != "cbc-encrypt" && op != "cbc-decrypt" && op != "ctr") {
+            fprintf(stderr, "unknown op: %s\n", op.c_str());
+            return 2;
+        }
+        for (std::size_t k = 0; k < opts.keys.size(); ++k) {
+            const std::string &keys = opts.keys[k];
+            if (keys != "private" && keys != "shared") {
+                fprintf(stderr, "unknown keys: %s\n", keys.c_str());
+                return 2;
+            }
+
+            const std::size_t first = results.size();
+            double single = 0;
+            for (std::size_t t = 0; t < opts.threads.size(); ++t) {
+                Result r = run_threads(opts, op, keys, opts.threads[t]);
+                if (t == 0) {
+                    // the smallest thread count is the reference of the efficiency
+                    single = r.mb_per_s / r.threads;
+                }
+                r.efficiency = r.mb_per_s / (single * r.threads);
+                print_result(r);
+                results.push_back(r);
+            }
+            const unsigned point = saturation_point(results, first, results.size());
+            printf("%-12s %-8s saturates at %u threads (%.0f%% of the peak throughput)\n",
+                op.c_str(), keys.c_str(), point, kSaturation * 100);
+            saturation.resize(results.size(), point);
+        }
+    }
+
+    if (!opts.json.empty()) {
+        write_json(opts.json, opts, results, saturation);
+    }
+    return 0;
+}
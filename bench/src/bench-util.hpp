@@ -0,0 +1,428 @@
+// Common helpers of the benchmark programs: timing, option parsing and JSON output.
+#ifndef PLUSAES_BENCH_UTIL_HPP__
+#define PLUSAES_BENCH_UTIL_HPP__
+
+#include "plusaes/plusaes.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+
+/** Monotonic time in nanoseconds. */
+inline uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/** True if read_tsc() counts time stamp counter ticks. */
+inline bool has_tsc() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Time stamp counter, 0 without one.
+ * It ticks at the nominal frequency, which differs from the core clock under turbo or power saving.
+ */
+inline uint64_t read_tsc() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/** Hardware events counted around the measured kernels. */
+enum PerfEvent {
+    kPerfCycles = 0,
+    kPerfInstructions,
+    kPerfL1dMisses,
+    kPerfBranchMisses,
+    kPerfEventCount
+};
+
+/** JSON key of event. */
+inline const char *perf_event_name(const int event) {
+    static const char *const names[kPerfEventCount] = {"cycles", "instructions", "l1d_misses", "branch_misses"};
+    return names[event];
+}
+
+/** Event counts; valid[i] is false if event i could not be counted. */
+struct PerfValues {
+    bool valid[kPerfEventCount];
+    double value[kPerfEventCount];
+
+    bool any() const {
+        for (int i = 0; i < kPerfEventCount; ++i) {
+            if (valid[i]) return true;
+        }
+        return false;
+    }
+};
+
+/**
+ * User space counters of the calling thread by Linux perf_event_open.
+ * Each event has its own counter, so an event that the CPU or the kernel does not
+ * provide (e.g. in a VM, or with kernel.perf_event_paranoid > 2) is just missing.
+ * The counts are scaled when the kernel multiplexes the counters.
+ */
+class PerfCounters {
+public:
+    PerfCounters() {
+        for (int i = 0; i < kPerfEventCount; ++i) {
+            fds_[i] = -1;
+        }
+#if defined(__linux__)
+        const uint64_t configs[kPerfEventCount][2] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+        for (int i = 0; i < kPerfEventCount; ++i) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = static_cast<uint32_t>(configs[i][0]);
+            attr.config = configs[i][1];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds_[i] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    ~PerfCounters() {
+#if defined(__linux__)
+        for (int i = 0; i < kPerfEventCount; ++i) {
+            if (fds_[i] >= 0) close(fds_[i]);
+        }
+#endif
+    }
+
+    bool available() const {
+        for (int i = 0; i < kPerfEventCount; ++i) {
+            if (fds_[i] >= 0) return true;
+        }
+        return false;
+    }
+
+    /** Resets and starts the counters. */
+    void start() {
+#if defined(__linux__)
+        for (int i = 0; i < kPerfEventCount; ++i) {
+            if (fds_[i] >= 0) {
+                ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    /** Stops the counters and reads the counts since start(). */
+    PerfValues stop() {
+        PerfValues v;
+        for (int i = 0; i < kPerfEventCount; ++i) {
+            v.valid[i] = false;
+            v.value[i] = 0;
+        }
+#if defined(__linux__)
+        for (int i = 0; i < kPerfEventCount; ++i) {
+            if (fds_[i] >= 0) {
+                ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+        for (int i = 0; i < kPerfEventCount; ++i) {
+            uint64_t data[3]; // value, time enabled, time running
+            if (fds_[i] < 0 || read(fds_[i], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) || data[2] == 0) {
+                continue;
+            }
+            v.valid[i] = true;
+            v.value[i] = static_cast<double>(data[0]) * (static_cast<double>(data[1]) / static_cast<double>(data[2]));
+        }
+#endif
+        return v;
+    }
+
+private:
+    PerfCounters(const PerfCounters &);
+    PerfCounters &operator=(const PerfCounters &);
+
+    int fds_[kPerfEventCount];
+};
+
+/** Counters used by run_timed, or 0 if disabled by set_perf_enabled(false). */
+inline PerfCounters *&perf_counters_ptr() {
+    static PerfCounters *counters = 0;
+    return counters;
+}
+
+/** Opens (or closes) the counters used by run_timed. They are closed by default. */
+inline void set_perf_enabled(const bool enabled) {
+    PerfCounters *&p = perf_counters_ptr();
+    delete p;
+    p = enabled ? new PerfCounters() : 0;
+}
+
+/** Time of a piece of work in nanoseconds and TSC ticks. */
+struct Sample {
+    uint64_t ns;
+    uint64_t tsc;
+};
+
+/** Measures f() once. */
+template<typename F>
+Sample measure(F f) {
+    const uint64_t t0 = now_ns();
+    const uint64_t c0 = read_tsc();
+    f();
+    const uint64_t c1 = read_tsc();
+    const uint64_t t1 = now_ns();
+    Sample s = {t1 - t0, c1 - c0};
+    return s;
+}
+
+/** Summary of the samples of f(): the time and the event counts per call. */
+struct Timing {
+    double ns_median;
+    double ns_min;
+    double tsc_median;
+    unsigned long calls;
+    unsigned long samples;
+    /** Means over all the calls, without the warm-up. */
+    PerfValues perf;
+};
+
+/**
+ * Runs f() repeatedly after a warm-up call.
+ * Calls are grouped so that each sample takes at least about 1 ms, and sampling stops after
+ * min_time seconds with at least 3 samples, or after one sample if a single call took longer.
+ */
+template<typename F>
+Timing run_timed(F f, const double min_time) {
+    const Sample warm = measure(f);
+
+    unsigned long calls_per_sample = 1;
+    if (warm.ns < 1000000) {
+        calls_per_sample = static_cast<unsigned long>(1000000 / (warm.ns + 1)) + 1;
+    }
+
+    std::vector<double> ns, tsc;
+    PerfCounters *counters = perf_counters_ptr();
+    if (counters) {
+        counters->start();
+    }
+    const uint64_t start = now_ns();
+    const uint64_t limit = static_cast<uint64_t>(min_time * 1e9);
+    for (;;) {
+        const Sample s = measure([&] {
+            for (unsigned long i = 0; i < calls_per_sample; ++i) {
+                f();
+            }
+        });
+        ns.push_back(static_cast<double>(s.ns) / calls_per_sample);
+        tsc.push_back(static_cast<double>(s.tsc) / calls_per_sample);
+
+        const uint64_t elapsed = now_ns() - start;
+        if (elapsed >= limit && (ns.size() >= 3 || warm.ns >= limit)) {
+            break;
+        }
+    }
+
+    Timing t;
+    t.samples = static_cast<unsigned long>(ns.size());
+    t.calls = t.samples * calls_per_sample;
+    if (counters) {
+        t.perf = counters->stop();
+    }
+    else {
+        for (int i = 0; i < kPerfEventCount; ++i) {
+            t.perf.valid[i] = false;
+            t.perf.value[i] = 0;
+        }
+    }
+    for (int i = 0; i < kPerfEventCount; ++i) {
+        t.perf.value[i] /= static_cast<double>(t.calls);
+    }
+    t.ns_min = *std::min_element(ns.begin(), ns.end());
+    std::nth_element(ns.begin(), ns.begin() + ns.size() / 2, ns.end());
+    std::nth_element(tsc.begin(), tsc.begin() + tsc.size() / 2, tsc.end());
+    t.ns_median = ns[ns.size() / 2];
+    t.tsc_median = tsc[tsc.size() / 2];
+    return t;
+}
+
+/** Parses "16", "4K", "1M" or "1G" (powers of 1024). Returns 0 on error. */
+inline unsigned long long parse_size(const char *s) {
+    char *end = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    switch (*end) {
+    case 'K': case 'k': v <<= 10; ++end; break;
+    case 'M': case 'm': v <<= 20; ++end; break;
+    case 'G': case 'g': v <<= 30; ++end; break;
+    default: break;
+    }
+    return (end == s || *end != '\0') ? 0 : v;
+}
+
+/** Splits "a,b,c". */
+inline std::vector<std::string> split(const std::string &s) {
+    std::vector<std::string> items;
+    std::string::size_type pos = 0;
+    for (;;) {
+        const std::string::size_type comma = s.find(',', pos);
+        items.push_back(s.substr(pos, comma - pos));
+        if (comma == std::string::npos) {
+            return items;
+        }
+        pos = comma + 1;
+    }
+}
+
+inline bool contains(const std::vector<std::string> &items, const std::string &s) {
+    return std::find(items.begin(), items.end(), s) != items.end();
+}
+
+/** Forces the backend named name. Returns false if it is unknown or unsupported. */
+inline bool select_backend(const std::string &name) {
+    const plusaes::Backend backends[] = {
+        plusaes::kBackendAuto, plusaes::kBackendReference, plusaes::kBackendTTable, plusaes::kBackendBitslice,
+        plusaes::kBackendVperm, plusaes::kBackendAesni, plusaes::kBackendVaes
+    };
+    for (std::size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+        if (name == plusaes::backend_name(backends[i])) {
+            return plusaes::set_backend(backends[i]) == plusaes::kErrorOk;
+        }
+    }
+    return false;
+}
+
+/** Bytes filled with a fixed pattern. */
+inline std::vector<unsigned char> make_bytes(const std::size_t size, const unsigned int seed) {
+    std::vector<unsigned char> v(size);
+    uint32_t x = seed * 2654435761u + 1;
+    for (std::size_t i = 0; i < size; ++i) {
+        x = x * 1103515245u + 12345u;
+        v[i] = static_cast<unsigned char>(x >> 24);
+    }
+    return v;
+}
+
+/**
+ * Minimal JSON writer for the result files.
+ * Objects and arrays are opened and closed explicitly, and commas are inserted as needed.
+ */
+class JsonWriter {
+public:
+    explicit JsonWriter(FILE *fp) : fp_(fp), first_(true), depth_(0) {}
+
+    void begin_object(const char *key = 0) { open(key, '{'); }
+    void end_object() { close('}'); }
+    void begin_array(const char *key = 0) { open(key, '['); }
+    void end_array() { close(']'); }
+
+    void value(const char *key, const std::string &v) {
+        write_key(key);
+        fputc('"', fp_);
+        for (std::string::size_type i = 0; i < v.size(); ++i) {
+            const char c = v[i];
+            if (c == '"' || c == '\\') {
+                fputc('\\', fp_);
+            }
+            fputc(c, fp_);
+        }
+        fputc('"', fp_);
+    }
+
+    void value(const char *key, const char *v) { value(key, std::string(v)); }
+
+    void value(const char *key, const double v) {
+        write_key(key);
+        fprintf(fp_, "%.6g", v);
+    }
+
+    void value(const char *key, const unsigned long long v) {
+        write_key(key);
+        fprintf(fp_, "%llu", v);
+    }
+
+    void value(const char *key, const int v) { value(key, static_cast<double>(v)); }
+    void value(const char *key, const unsigned long v) { value(key, static_cast<unsigned long long>(v)); }
+
+    void null(const char *key) {
+        write_key(key);
+        fputs("null", fp_);
+    }
+
+private:
+    void open(const char *key, const char c) {
+        write_key(key);
+        fputc(c, fp_);
+        first_ = true;
+        ++depth_;
+    }
+
+    void close(const char c) {
+        --depth_;
+        newline();
+        fputc(c, fp_);
+        first_ = false;
+        if (depth_ == 0) {
+            fputc('\n', fp_);
+        }
+    }
+
+    void write_key(const char *key) {
+        if (!first_) {
+            fputc(',', fp_);
+        }
+        if (depth_ > 0) {
+            newline();
+        }
+        first_ = false;
+        if (key) {
+            fprintf(fp_, "\"%s\": ", key);
+        }
+    }
+
+    void newline() {
+        fputc('\n', fp_);
+        for (int i = 0; i < depth_; ++i) {
+            fputs("  ", fp_);
+        }
+    }
+
+    FILE *fp_;
+    bool first_;
+    int depth_;
+};
+
+} // namespace bench
+
+#endif // PLUSAES_BENCH_UTIL_HPP__
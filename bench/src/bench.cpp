@@ -0,0 +1,354 @@
+// Throughput benchmark: ECB/CBC/CTR at each key size over message sizes, and key setup.
+#include "bench-util.hpp"
+
+#include <new>
+
+namespace {
+
+struct Options {
+    std::vector<std::string> modes;
+    std::vector<std::string> key_bits;
+    unsigned long long min_size;
+    unsigned long long max_size;
+    double min_time;
+    bool perf;
+    std::string backend;
+    std::string json;
+};
+
+struct Result {
+    std::string mode;
+    std::string op;
+    int key_bits;
+    unsigned long long size;
+    bench::Timing timing;
+};
+
+/** Key setup: a KeySchedule, or a raw key call on one block, which expands the key its mode needs. */
+struct KeySetup {
+    std::string op; // "schedule" or the mode and operation of the raw key call
+    int key_bits;
+    bench::Timing timing;
+};
+
+void print_usage() {
+    printf(
+        "usage: bench [options]\n"
+        "  --mode LIST      ecb,cbc,ctr (default: all)\n"
+        "  --key LIST       128,192,256 (default: all)\n"
+        "  --min-size N     smallest message, 16 B steps (default: 16)\n"
+        "  --max-size N     largest message, e.g. 64M (default: 1G)\n"
+        "  --min-time SEC   measuring time per case (default: 0.2)\n"
+        "  --backend NAME   force a backend (reference, ttable, bitslice, vperm, aesni, vaes)\n"
+        "  --perf on|off    count cycles, instructions, L1D and branch misses per block (default: on)\n"
+        "  --json FILE      write the results as JSON\n"
+        "The message sizes are min-size * 4^n. CTR decryption is the same operation as encryption.\n"
+        "The key setup is timed for a KeySchedule and for 16 B calls with the raw key.\n");
+}
+
+bool parse_options(int argc, char **argv, Options &opts) {
+    opts.modes = bench::split("ecb,cbc,ctr");
+    opts.key_bits = bench::split("128,192,256");
+    opts.min_size = 16;
+    opts.max_size = 1ULL << 30;
+    opts.min_time = 0.2;
+    opts.perf = true;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char *v = argv[++i];
+        if (arg == "--mode") {
+            opts.modes = bench::split(v);
+        }
+        else if (arg == "--key") {
+            opts.key_bits = bench::split(v);
+        }
+        else if (arg == "--min-size") {
+            opts.min_size = bench::parse_size(v);
+        }
+        else if (arg == "--max-size") {
+            opts.max_size = bench::parse_size(v);
+        }
+        else if (arg == "--min-time") {
+            opts.min_time = atof(v);
+        }
+        else if (arg == "--perf") {
+            opts.perf = std::string(v) != "off";
+        }
+        else if (arg == "--backend") {
+            opts.backend = v;
+        }
+        else if (arg == "--json") {
+            opts.json = v;
+        }
+        else {
+            return false;
+        }
+    }
+    return opts.min_size >= 16 && opts.min_size % 16 == 0 && opts.min_size <= opts.max_size;
+}
+
+double mb_per_s(const Result &r) {
+    return static_cast<double>(r.size) / r.timing.ns_median * 1e3;
+}
+
+double cycles_per_byte(const Result &r) {
+    return r.timing.tsc_median / static_cast<double>(r.size);
+}
+
+/** Counts per 16 bytes block. */
+bench::PerfValues perf_per_block(const Result &r) {
+    bench::PerfValues v = r.timing.perf;
+    for (int i = 0; i < bench::kPerfEventCount; ++i) {
+        v.value[i] /= static_cast<double>(r.size / 16);
+    }
+    return v;
+}
+
+void print_perf(const bench::PerfValues &v) {
+    if (!v.any()) {
+        return;
+    }
+    const char *const labels[bench::kPerfEventCount] = {"cyc", "ins", "l1d", "brm"};
+    printf(" |");
+    for (int i = 0; i < bench::kPerfEventCount; ++i) {
+        if (v.valid[i]) {
+            printf(" %s %.4g", labels[i], v.value[i]);
+        }
+    }
+    if (v.valid[bench::kPerfCycles] && v.valid[bench::kPerfInstructions] && v.value[bench::kPerfCycles] > 0) {
+        printf(" ipc %.2f", v.value[bench::kPerfInstructions] / v.value[bench::kPerfCycles]);
+    }
+}
+
+void write_perf(bench::JsonWriter &w, const char *key, const bench::PerfValues &v) {
+    w.begin_object(key);
+    for (int i = 0; i < bench::kPerfEventCount; ++i) {
+        if (v.valid[i]) {
+            w.value(bench::perf_event_name(i), v.value[i]);
+        }
+        else {
+            w.null(bench::perf_event_name(i));
+        }
+    }
+    w.end_object();
+}
+
+void print_result(const Result &r) {
+    printf("%-4s %-8s %3d %11llu %10.1f MB/s", r.mode.c_str(), r.op.c_str(), r.key_bits, r.size, mb_per_s(r));
+    if (bench::has_tsc()) {
+        printf(" %8.2f cycles/B", cycles_per_byte(r));
+    }
+    print_perf(perf_per_block(r));
+    printf("\n");
+    fflush(stdout);
+}
+
+void write_json(const std::string &path, const std::vector<KeySetup> &setups, const std::vector<Result> &results) {
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp) {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return;
+    }
+
+    bench::JsonWriter w(fp);
+    w.begin_object();
+    char version[16];
+    snprintf(version, sizeof(version), "%08x", plusaes::version());
+    w.value("version", version);
+    w.value("backend", plusaes::backend_name(plusaes::active_backend()));
+    w.value("tsc", bench::has_tsc() ? "rdtsc" : "none");
+
+    w.begin_array("key_setup");
+    for (std::size_t i = 0; i < setups.size(); ++i) {
+        w.begin_object();
+        w.value("op", setups[i].op);
+        w.value("key_bits", setups[i].key_bits);
+        w.value("ns", setups[i].timing.ns_median);
+        w.value("ns_min", setups[i].timing.ns_min);
+        if (bench::has_tsc()) {
+            w.value("cycles", setups[i].timing.tsc_median);
+        }
+        else {
+            w.null("cycles");
+        }
+        write_perf(w, "perf", setups[i].timing.perf);
+        w.end_object();
+    }
+    w.end_array();
+
+    w.begin_array("results");
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        w.begin_object();
+        w.value("mode", r.mode);
+        w.value("op", r.op);
+        w.value("key_bits", r.key_bits);
+        w.value("size", r.size);
+        w.value("ns", r.timing.ns_median);
+        w.value("ns_min", r.timing.ns_min);
+        w.value("mb_per_s", mb_per_s(r));
+        if (bench::has_tsc()) {
+            w.value("cycles_per_byte", cycles_per_byte(r));
+        }
+        else {
+            w.null("cycles_per_byte");
+        }
+        w.value("calls", r.timing.calls);
+        write_perf(w, "perf_per_block", perf_per_block(r));
+        w.end_object();
+    }
+    w.end_array();
+    w.end_object();
+
+    fclose(fp);
+}
+
+} // no namespace
+
+int main(int argc, char **argv) {
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        print_usage();
+        return 2;
+    }
+    if (!opts.backend.empty() && !bench::select_backend(opts.backend)) {
+        fprintf(stderr, "unsupported backend: %s\n", opts.backend.c_str());
+        return 2;
+    }
+    printf("plusaes %08x, backend %s\n", plusaes::version(), plusaes::backend_name(plusaes::active_backend()));
+    if (opts.perf) {
+        bench::set_perf_enabled(true);
+        if (!bench::perf_counters_ptr()->available()) {
+            printf("no hardware performance counters (perf_event_open)\n");
+        }
+    }
+
+    // the buffers for the largest message
+    std::vector<unsigned char> in, out;
+    unsigned long long max_size = opts.max_size;
+    for (;;) {
+        try {
+            in = bench::make_bytes(static_cast<std::size_t>(max_size), 1);
+            out.resize(static_cast<std::size_t>(max_size));
+            break;
+        }
+        catch (const std::bad_alloc &) {
+            max_size /= 4;
+            if (max_size < opts.min_size) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+            fprintf(stderr, "out of memory, --max-size %llu\n", max_size);
+        }
+    }
+    std::memset(&out[0], 0, out.size());
+
+    const std::vector<unsigned char> key = bench::make_bytes(32, 2);
+    const unsigned char iv[16] = {};
+
+    std::vector<KeySetup> setups;
+    std::vector<Result> results;
+    for (std::size_t k = 0; k < opts.key_bits.size(); ++k) {
+        const int key_bits = atoi(opts.key_bits[k].c_str());
+        if (!plusaes::detail::is_valid_key_size(static_cast<unsigned long>(key_bits / 8))) {
+            fprintf(stderr, "invalid key size: %s\n", opts.key_bits[k].c_str());
+            return 2;
+        }
+
+        const char *const setup_ops[] = {"schedule", "ecb-encrypt", "ecb-decrypt", "cbc-decrypt", "ctr-crypt"};
+        for (std::size_t o = 0; o < sizeof(setup_ops) / sizeof(setup_ops[0]); ++o) {
+            const std::string op = setup_ops[o];
+            const unsigned long key_size = static_cast<unsigned long>(key_bits / 8);
+            volatile unsigned char sink = 0;
+            KeySetup setup;
+            setup.op = op;
+            setup.key_bits = key_bits;
+            setup.timing = bench::run_timed([&] {
+                if (op == "schedule") {
+                    const plusaes::KeySchedule ks(&key[0], key_size);
+                    sink = sink ^ static_cast<unsigned char>(ks.round_keys()[1][0]);
+                }
+                else if (op == "ecb-encrypt") {
+                    plusaes::encrypt_ecb(&in[0], 16, &key[0], key_size, &out[0], 16, false);
+                }
+                else if (op == "ecb-decrypt") {
+                    plusaes::decrypt_ecb(&in[0], 16, &key[0], key_size, &out[0], 16, 0);
+                }
+                else if (op == "cbc-decrypt") {
+                    plusaes::decrypt_cbc(&in[0], 16, &key[0], key_size, &iv, &out[0], 16, 0);
+                }
+                else {
+                    plusaes::crypt_ctr(&out[0], 16, &key[0], key_size, iv, sizeof(iv));
+                }
+            }, opts.min_time);
+            setups.push_back(setup);
+            printf("key setup %3d %-11s %10.1f ns", key_bits, op.c_str(), setup.timing.ns_median);
+            if (bench::has_tsc()) {
+                printf(" %8.0f cycles", setup.timing.tsc_median);
+            }
+            print_perf(setup.timing.perf);
+            printf("\n");
+        }
+
+        const plusaes::KeySchedule ks(&key[0], key_bits / 8);
+        for (std::size_t m = 0; m < opts.modes.size(); ++m) {
+            const std::string &mode = opts.modes[m];
+            if (mode != "ecb" && mode != "cbc" && mode != "ctr") {
+                fprintf(stderr, "unknown mode: %s\n", mode.c_str());
+                return 2;
+            }
+
+            for (unsigned long long size = opts.min_size; size <= max_size; size *= 4) {
+                const unsigned long n = static_cast<unsigned long>(size);
+                for (int dir = 0; dir < 2; ++dir) {
+                    Result r;
+                    r.mode = mode;
+                    r.key_bits = key_bits;
+                    r.size = size;
+                    if (mode == "ctr") {
+                        if (dir == 1) {
+                            break;
+                        }
+                        r.op = "crypt";
+                        r.timing = bench::run_timed([&] {
+                            plusaes::crypt_ctr(&out[0], n, ks, iv, sizeof(iv));
+                        }, opts.min_time);
+                    }
+                    else if (mode == "ecb") {
+                        r.op = dir == 0 ? "encrypt" : "decrypt";
+                        r.timing = bench::run_timed([&] {
+                            if (dir == 0) {
+                                plusaes::encrypt_ecb(&in[0], n, ks, &out[0], n, false);
+                            }
+                            else {
+                                plusaes::decrypt_ecb(&in[0], n, ks, &out[0], n, 0);
+                            }
+                        }, opts.min_time);
+                    }
+                    else {
+                        r.op = dir == 0 ? "encrypt" : "decrypt";
+                        r.timing = bench::run_timed([&] {
+                            if (dir == 0) {
+                                plusaes::encrypt_cbc(&in[0], n, ks, &iv, &out[0], n, false);
+                            }
+                            else {
+                                plusaes::decrypt_cbc(&in[0], n, ks, &iv, &out[0], n, 0);
+                            }
+                        }, opts.min_time);
+                    }
+                    results.push_back(r);
+                    print_result(r);
+                }
+            }
+        }
+    }
+
+    if (!opts.json.empty()) {
+        write_json(opts.json, setups, results);
+    }
+    return 0;
+}
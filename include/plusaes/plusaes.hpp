@@ -7,15 +7,188 @@
 #ifndef PLUSAES_HPP__
 #define PLUSAES_HPP__
 
+/**
+ * 1 if plusaes must not throw. It is detected from the compiler options (-fno-exceptions).
+ * Then detail::expand_key returns an empty schedule for an invalid key size.
+ * Apart from key_from_string, the public APIs never throw nor allocate either way; they return Error.
+ */
+#ifndef PLUSAES_NO_EXCEPTIONS
+#if (defined(__GNUC__) && !defined(__EXCEPTIONS)) || (defined(_MSC_VER) && !defined(_CPPUNWIND))
+#define PLUSAES_NO_EXCEPTIONS 1
+#else
+#define PLUSAES_NO_EXCEPTIONS 0
+#endif
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#if !PLUSAES_NO_EXCEPTIONS
 #include <stdexcept>
+#endif
 #include <vector>
+#include <stdint.h>
+
+/** 1 if std::atomic holds the active backend, else the compiler's atomic builtins. */
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#define PLUSAES_HAS_STD_ATOMIC 1
+#include <atomic>
+#else
+#define PLUSAES_HAS_STD_ATOMIC 0
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
 
 /** Version number of plusaes.
  * 0x01020304 -> 1.2.3.4 */
 #define PLUSAES_VERSION 0x00090100
 
+/** Set to 0 to use the byte-wise reference rounds instead of the T-tables. */
+#ifndef PLUSAES_USE_TTABLE
+#define PLUSAES_USE_TTABLE 1
+#endif
+
+/**
+ * Set to 1 to use the bitsliced rounds instead of the T-tables or the reference rounds.
+ * They evaluate the S-box as a boolean circuit, so no memory access of the block cipher
+ * (rounds and key schedule) depends on the key or the data.
+ * AES-NI is still preferred when the CPU has it, and so is the vector permute backend when enabled.
+ */
+#ifndef PLUSAES_USE_BITSLICE
+#define PLUSAES_USE_BITSLICE 0
+#endif
+
+/**
+ * Set to 0 not to use the SSSE3 vector permute backend without AES-NI.
+ * It looks up the S-box in registers, one block at a time for single and multiple blocks,
+ * and the key schedule uses the same S-box, so no memory access of the block cipher depends
+ * on the key or the data. It runs at about the speed of the T-tables; it is the default
+ * for the constant time, not for speed. GHASH without PCLMULQDQ still uses tables.
+ */
+#ifndef PLUSAES_USE_VPERM
+#define PLUSAES_USE_VPERM 1
+#endif
+
+/**
+ * 1 if the AES-NI code path is compiled in. It is used only when CPUID reports AES-NI.
+ * Define PLUSAES_DISABLE_AESNI to exclude it.
+ */
+#if !defined(PLUSAES_DISABLE_AESNI) && \
+    (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#if defined(_MSC_VER) && _MSC_VER >= 1600
+#define PLUSAES_HAS_AESNI 1
+#define PLUSAES_TARGET_AESNI
+#define PLUSAES_TARGET_PCLMUL
+#define PLUSAES_TARGET_SSE2
+#define PLUSAES_TARGET_SSSE3
+#define PLUSAES_TARGET_AVX2
+#define PLUSAES_TARGET_VAES_AVX2
+#define PLUSAES_TARGET_VAES_AVX512
+#if _MSC_VER >= 1700
+#define PLUSAES_HAS_AVX2 1
+#endif
+#if _MSC_VER >= 1920 && !defined(PLUSAES_DISABLE_VAES)
+#define PLUSAES_HAS_VAES 1
+#endif
+#elif defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define PLUSAES_HAS_AESNI 1
+#define PLUSAES_TARGET_AESNI __attribute__((target("aes,sse2")))
+#define PLUSAES_TARGET_PCLMUL __attribute__((target("aes,pclmul,sse2,ssse3")))
+#define PLUSAES_TARGET_SSE2 __attribute__((target("sse2")))
+#define PLUSAES_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define PLUSAES_TARGET_AVX2 __attribute__((target("avx2")))
+#define PLUSAES_HAS_AVX2 1
+#if ((defined(__clang__) && __clang_major__ >= 6) || (!defined(__clang__) && __GNUC__ >= 8)) && \
+    !defined(PLUSAES_DISABLE_VAES)
+#define PLUSAES_TARGET_VAES_AVX2 __attribute__((target("aes,vaes,avx2")))
+#define PLUSAES_TARGET_VAES_AVX512 __attribute__((target("aes,vaes,avx512f")))
+#define PLUSAES_HAS_VAES 1
+#endif
+#endif
+#endif
+
+#ifndef PLUSAES_HAS_AESNI
+#define PLUSAES_HAS_AESNI 0
+#endif
+
+/** 1 if the AVX2 bitsliced rounds are compiled in (with the AES-NI code path). */
+#ifndef PLUSAES_HAS_AVX2
+#define PLUSAES_HAS_AVX2 0
+#endif
+
+/**
+ * 1 if the VAES kernels (2 blocks per AVX2 register, 4 per AVX-512 register) are compiled in.
+ * They are used only when CPUID reports VAES. Define PLUSAES_DISABLE_VAES to exclude them.
+ */
+#ifndef PLUSAES_HAS_VAES
+#define PLUSAES_HAS_VAES 0
+#endif
+
+/** Inlines a function even into a caller with other target options. */
+#if defined(_MSC_VER)
+#define PLUSAES_FORCE_INLINE __forceinline
+#else
+#define PLUSAES_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+/** Aligns a member to 16 bytes (one SSE register). */
+#if defined(_MSC_VER)
+#define PLUSAES_ALIGN16 __declspec(align(16))
+#else
+#define PLUSAES_ALIGN16 __attribute__((aligned(16)))
+#endif
+
+#if PLUSAES_HAS_AESNI
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#if PLUSAES_HAS_AVX2
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
 /** AES cipher APIs */
 namespace plusaes {
+
+/**
+ * Implementation of the AES rounds (block cipher backend).
+ * @see active_backend
+ */
+typedef enum {
+    /** The fastest one that the CPU supports. */
+    kBackendAuto = 0,
+    /** Byte-wise rounds of FIPS-197. */
+    kBackendReference,
+    /** 32-bit T-tables. */
+    kBackendTTable,
+    /** Constant-time bitsliced rounds. */
+    kBackendBitslice,
+    /** Constant-time SSSE3 vector permute rounds. */
+    kBackendVperm,
+    /** AES-NI. */
+    kBackendAesni,
+    /** VAES (AVX2/AVX-512) for multiple blocks, AES-NI for single blocks. */
+    kBackendVaes
+} Backend;
+
+/** Name of backend, which is also the value of the PLUSAES_BACKEND environment variable. */
+inline const char *backend_name(const Backend backend) {
+    switch (backend) {
+    case kBackendReference: return "reference";
+    case kBackendTTable: return "ttable";
+    case kBackendBitslice: return "bitslice";
+    case kBackendVperm: return "vperm";
+    case kBackendAesni: return "aesni";
+    case kBackendVaes: return "vaes";
+    default: return "auto";
+    }
+}
+
 namespace detail {
 
 const int kWordSize = 4;
@@ -35,7 +208,44 @@ typedef struct {
 
 const int kStateSize = 16; // Word * BlockSize
 typedef State RoundKey;
-typedef std::vector<RoundKey> RoundKeys;
+
+const int kMaxRounds = 14;
+
+/**
+ * @private
+ * Round keys for up to AES-256 in a fixed array, so a schedule never allocates.
+ */
+struct RoundKeys {
+    PLUSAES_ALIGN16 RoundKey keys[kMaxRounds + 1];
+    int rounds;
+
+    RoundKeys() : rounds(0) {}
+
+    std::size_t size() const {
+        return static_cast<std::size_t>(rounds) + 1;
+    }
+    RoundKey & operator[](const std::size_t index) {
+        return keys[index];
+    }
+    const RoundKey & operator[](const std::size_t index) const {
+        return keys[index];
+    }
+    const RoundKey & front() const {
+        return keys[0];
+    }
+    const RoundKey & back() const {
+        return keys[rounds];
+    }
+    void clear() {
+        rounds = 0;
+        memset(keys, 0, sizeof(keys));
+    }
+};
+
+/** Round count of a key schedule (10, 12 or 14). */
+inline int get_rounds(const RoundKeys &rkeys) {
+    return rkeys.rounds;
+}
 
 inline void add_round_key(const RoundKey &key, State &state) {
     for (int i = 0; i < kBlockSize; ++i) {
@@ -43,44 +253,90 @@ inline void add_round_key(const RoundKey &key, State &state) {
     }
 }
 
+#define PLUSAES_SBOX(F) \
+    F(0x63) F(0x7c) F(0x77) F(0x7b) F(0xf2) F(0x6b) F(0x6f) F(0xc5) F(0x30) F(0x01) F(0x67) F(0x2b) F(0xfe) F(0xd7) F(0xab) F(0x76) \
+    F(0xca) F(0x82) F(0xc9) F(0x7d) F(0xfa) F(0x59) F(0x47) F(0xf0) F(0xad) F(0xd4) F(0xa2) F(0xaf) F(0x9c) F(0xa4) F(0x72) F(0xc0) \
+    F(0xb7) F(0xfd) F(0x93) F(0x26) F(0x36) F(0x3f) F(0xf7) F(0xcc) F(0x34) F(0xa5) F(0xe5) F(0xf1) F(0x71) F(0xd8) F(0x31) F(0x15) \
+    F(0x04) F(0xc7) F(0x23) F(0xc3) F(0x18) F(0x96) F(0x05) F(0x9a) F(0x07) F(0x12) F(0x80) F(0xe2) F(0xeb) F(0x27) F(0xb2) F(0x75) \
+    F(0x09) F(0x83) F(0x2c) F(0x1a) F(0x1b) F(0x6e) F(0x5a) F(0xa0) F(0x52) F(0x3b) F(0xd6) F(0xb3) F(0x29) F(0xe3) F(0x2f) F(0x84) \
+    F(0x53) F(0xd1) F(0x00) F(0xed) F(0x20) F(0xfc) F(0xb1) F(0x5b) F(0x6a) F(0xcb) F(0xbe) F(0x39) F(0x4a) F(0x4c) F(0x58) F(0xcf) \
+    F(0xd0) F(0xef) F(0xaa) F(0xfb) F(0x43) F(0x4d) F(0x33) F(0x85) F(0x45) F(0xf9) F(0x02) F(0x7f) F(0x50) F(0x3c) F(0x9f) F(0xa8) \
+    F(0x51) F(0xa3) F(0x40) F(0x8f) F(0x92) F(0x9d) F(0x38) F(0xf5) F(0xbc) F(0xb6) F(0xda) F(0x21) F(0x10) F(0xff) F(0xf3) F(0xd2) \
+    F(0xcd) F(0x0c) F(0x13) F(0xec) F(0x5f) F(0x97) F(0x44) F(0x17) F(0xc4) F(0xa7) F(0x7e) F(0x3d) F(0x64) F(0x5d) F(0x19) F(0x73) \
+    F(0x60) F(0x81) F(0x4f) F(0xdc) F(0x22) F(0x2a) F(0x90) F(0x88) F(0x46) F(0xee) F(0xb8) F(0x14) F(0xde) F(0x5e) F(0x0b) F(0xdb) \
+    F(0xe0) F(0x32) F(0x3a) F(0x0a) F(0x49) F(0x06) F(0x24) F(0x5c) F(0xc2) F(0xd3) F(0xac) F(0x62) F(0x91) F(0x95) F(0xe4) F(0x79) \
+    F(0xe7) F(0xc8) F(0x37) F(0x6d) F(0x8d) F(0xd5) F(0x4e) F(0xa9) F(0x6c) F(0x56) F(0xf4) F(0xea) F(0x65) F(0x7a) F(0xae) F(0x08) \
+    F(0xba) F(0x78) F(0x25) F(0x2e) F(0x1c) F(0xa6) F(0xb4) F(0xc6) F(0xe8) F(0xdd) F(0x74) F(0x1f) F(0x4b) F(0xbd) F(0x8b) F(0x8a) \
+    F(0x70) F(0x3e) F(0xb5) F(0x66) F(0x48) F(0x03) F(0xf6) F(0x0e) F(0x61) F(0x35) F(0x57) F(0xb9) F(0x86) F(0xc1) F(0x1d) F(0x9e) \
+    F(0xe1) F(0xf8) F(0x98) F(0x11) F(0x69) F(0xd9) F(0x8e) F(0x94) F(0x9b) F(0x1e) F(0x87) F(0xe9) F(0xce) F(0x55) F(0x28) F(0xdf) \
+    F(0x8c) F(0xa1) F(0x89) F(0x0d) F(0xbf) F(0xe6) F(0x42) F(0x68) F(0x41) F(0x99) F(0x2d) F(0x0f) F(0xb0) F(0x54) F(0xbb) F(0x16)
+
+#define PLUSAES_INV_SBOX(F) \
+    F(0x52) F(0x09) F(0x6a) F(0xd5) F(0x30) F(0x36) F(0xa5) F(0x38) F(0xbf) F(0x40) F(0xa3) F(0x9e) F(0x81) F(0xf3) F(0xd7) F(0xfb) \
+    F(0x7c) F(0xe3) F(0x39) F(0x82) F(0x9b) F(0x2f) F(0xff) F(0x87) F(0x34) F(0x8e) F(0x43) F(0x44) F(0xc4) F(0xde) F(0xe9) F(0xcb) \
+    F(0x54) F(0x7b) F(0x94) F(0x32) F(0xa6) F(0xc2) F(0x23) F(0x3d) F(0xee) F(0x4c) F(0x95) F(0x0b) F(0x42) F(0xfa) F(0xc3) F(0x4e) \
+    F(0x08) F(0x2e) F(0xa1) F(0x66) F(0x28) F(0xd9) F(0x24) F(0xb2) F(0x76) F(0x5b) F(0xa2) F(0x49) F(0x6d) F(0x8b) F(0xd1) F(0x25) \
+    F(0x72) F(0xf8) F(0xf6) F(0x64) F(0x86) F(0x68) F(0x98) F(0x16) F(0xd4) F(0xa4) F(0x5c) F(0xcc) F(0x5d) F(0x65) F(0xb6) F(0x92) \
+    F(0x6c) F(0x70) F(0x48) F(0x50) F(0xfd) F(0xed) F(0xb9) F(0xda) F(0x5e) F(0x15) F(0x46) F(0x57) F(0xa7) F(0x8d) F(0x9d) F(0x84) \
+    F(0x90) F(0xd8) F(0xab) F(0x00) F(0x8c) F(0xbc) F(0xd3) F(0x0a) F(0xf7) F(0xe4) F(0x58) F(0x05) F(0xb8) F(0xb3) F(0x45) F(0x06) \
+    F(0xd0) F(0x2c) F(0x1e) F(0x8f) F(0xca) F(0x3f) F(0x0f) F(0x02) F(0xc1) F(0xaf) F(0xbd) F(0x03) F(0x01) F(0x13) F(0x8a) F(0x6b) \
+    F(0x3a) F(0x91) F(0x11) F(0x41) F(0x4f) F(0x67) F(0xdc) F(0xea) F(0x97) F(0xf2) F(0xcf) F(0xce) F(0xf0) F(0xb4) F(0xe6) F(0x73) \
+    F(0x96) F(0xac) F(0x74) F(0x22) F(0xe7) F(0xad) F(0x35) F(0x85) F(0xe2) F(0xf9) F(0x37) F(0xe8) F(0x1c) F(0x75) F(0xdf) F(0x6e) \
+    F(0x47) F(0xf1) F(0x1a) F(0x71) F(0x1d) F(0x29) F(0xc5) F(0x89) F(0x6f) F(0xb7) F(0x62) F(0x0e) F(0xaa) F(0x18) F(0xbe) F(0x1b) \
+    F(0xfc) F(0x56) F(0x3e) F(0x4b) F(0xc6) F(0xd2) F(0x79) F(0x20) F(0x9a) F(0xdb) F(0xc0) F(0xfe) F(0x78) F(0xcd) F(0x5a) F(0xf4) \
+    F(0x1f) F(0xdd) F(0xa8) F(0x33) F(0x88) F(0x07) F(0xc7) F(0x31) F(0xb1) F(0x12) F(0x10) F(0x59) F(0x27) F(0x80) F(0xec) F(0x5f) \
+    F(0x60) F(0x51) F(0x7f) F(0xa9) F(0x19) F(0xb5) F(0x4a) F(0x0d) F(0x2d) F(0xe5) F(0x7a) F(0x9f) F(0x93) F(0xc9) F(0x9c) F(0xef) \
+    F(0xa0) F(0xe0) F(0x3b) F(0x4d) F(0xae) F(0x2a) F(0xf5) F(0xb0) F(0xc8) F(0xeb) F(0xbb) F(0x3c) F(0x83) F(0x53) F(0x99) F(0x61) \
+    F(0x17) F(0x2b) F(0x04) F(0x7e) F(0xba) F(0x77) F(0xd6) F(0x26) F(0xe1) F(0x69) F(0x14) F(0x63) F(0x55) F(0x21) F(0x0c) F(0x7d)
+
+#define PLUSAES_BYTE(v) (v),
+
 const unsigned char kSbox[] = {
-    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
-    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
-    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
-    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
-    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
-    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
-    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
-    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
-    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
-    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
-    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
-    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
-    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
-    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
-    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
-    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+    PLUSAES_SBOX(PLUSAES_BYTE)
 };
 
 const unsigned char kInvSbox[] = {
-    0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
-    0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
-    0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
-    0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
-    0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
-    0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
-    0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
-    0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
-    0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
-    0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
-    0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
-    0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
-    0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
-    0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
-    0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
-    0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d
+    PLUSAES_INV_SBOX(PLUSAES_BYTE)
 };
 
+// T-tables
+// Each entry fuses SubBytes (InvSubBytes) and one column of MixColumns (InvMixColumns)
+// for a byte in row 0 to 3. They are generated at compile time from the S-box lists above.
+
+#define PLUSAES_XTIME(v) ((((v) << 1) ^ ((((v) >> 7) & 1) * 0x1b)) & 0xFF)
+#define PLUSAES_MUL2(v) PLUSAES_XTIME(v)
+#define PLUSAES_MUL3(v) (PLUSAES_XTIME(v) ^ (v))
+#define PLUSAES_MUL9(v) (PLUSAES_XTIME(PLUSAES_XTIME(PLUSAES_XTIME(v))) ^ (v))
+#define PLUSAES_MULB(v) (PLUSAES_XTIME(PLUSAES_XTIME(PLUSAES_XTIME(v))) ^ PLUSAES_XTIME(v) ^ (v))
+#define PLUSAES_MULD(v) (PLUSAES_XTIME(PLUSAES_XTIME(PLUSAES_XTIME(v))) ^ PLUSAES_XTIME(PLUSAES_XTIME(v)) ^ (v))
+#define PLUSAES_MULE(v) (PLUSAES_XTIME(PLUSAES_XTIME(PLUSAES_XTIME(v))) ^ PLUSAES_XTIME(PLUSAES_XTIME(v)) ^ PLUSAES_XTIME(v))
+#define PLUSAES_WORD(b0, b1, b2, b3) \
+    (static_cast<Word>(b0) | static_cast<Word>(b1) << 8 | static_cast<Word>(b2) << 16 | static_cast<Word>(b3) << 24)
+
+#define PLUSAES_TE0(s) PLUSAES_WORD(PLUSAES_MUL2(s), (s), (s), PLUSAES_MUL3(s)),
+#define PLUSAES_TE1(s) PLUSAES_WORD(PLUSAES_MUL3(s), PLUSAES_MUL2(s), (s), (s)),
+#define PLUSAES_TE2(s) PLUSAES_WORD((s), PLUSAES_MUL3(s), PLUSAES_MUL2(s), (s)),
+#define PLUSAES_TE3(s) PLUSAES_WORD((s), (s), PLUSAES_MUL3(s), PLUSAES_MUL2(s)),
+#define PLUSAES_TE4(s) PLUSAES_WORD((s), (s), (s), (s)),
+
+#define PLUSAES_TD0(s) PLUSAES_WORD(PLUSAES_MULE(s), PLUSAES_MUL9(s), PLUSAES_MULD(s), PLUSAES_MULB(s)),
+#define PLUSAES_TD1(s) PLUSAES_WORD(PLUSAES_MULB(s), PLUSAES_MULE(s), PLUSAES_MUL9(s), PLUSAES_MULD(s)),
+#define PLUSAES_TD2(s) PLUSAES_WORD(PLUSAES_MULD(s), PLUSAES_MULB(s), PLUSAES_MULE(s), PLUSAES_MUL9(s)),
+#define PLUSAES_TD3(s) PLUSAES_WORD(PLUSAES_MUL9(s), PLUSAES_MULD(s), PLUSAES_MULB(s), PLUSAES_MULE(s)),
+#define PLUSAES_TD4(s) PLUSAES_WORD((s), (s), (s), (s)),
+
+const Word kTe0[256] = { PLUSAES_SBOX(PLUSAES_TE0) };
+const Word kTe1[256] = { PLUSAES_SBOX(PLUSAES_TE1) };
+const Word kTe2[256] = { PLUSAES_SBOX(PLUSAES_TE2) };
+const Word kTe3[256] = { PLUSAES_SBOX(PLUSAES_TE3) };
+const Word kTe4[256] = { PLUSAES_SBOX(PLUSAES_TE4) }; // last round
+
+const Word kTd0[256] = { PLUSAES_INV_SBOX(PLUSAES_TD0) };
+const Word kTd1[256] = { PLUSAES_INV_SBOX(PLUSAES_TD1) };
+const Word kTd2[256] = { PLUSAES_INV_SBOX(PLUSAES_TD2) };
+const Word kTd3[256] = { PLUSAES_INV_SBOX(PLUSAES_TD3) };
+const Word kTd4[256] = { PLUSAES_INV_SBOX(PLUSAES_TD4) }; // last round
+
 inline Word sub_word(const Word w) {
     return kSbox[(w >>  0) & 0xFF] <<  0 |
            kSbox[(w >>  8) & 0xFF] <<  8 |
@@ -129,66 +385,38 @@ inline void inv_shift_rows(State &state) {
     }
 }
 
-inline unsigned char mul2(const unsigned char b) {
-    unsigned char m2 = b << 1;
-    if (b & 0x80) {
-        m2 ^= 0x011B;
-    }
-
-    return m2;
+/** Multiplies the four bytes of a word by x (0x02) at once, without branches. */
+inline Word xtime_word(const Word w) {
+    const Word hi = (w >> 7) & 0x01010101;
+    return ((w & 0x7F7F7F7F) << 1) ^ (hi * 0x1B);
 }
 
-inline unsigned char mul(const unsigned char b, const unsigned char m) {
-    unsigned char v = 0;
-    unsigned char t = b;
-    for (int i = 0; i < 8; ++i) { // 8-bits
-        if ((m >> i) & 0x01) {
-            v ^= t;
-        }
-
-        t = mul2(t);
-    }
+/** Rotates a column so that row r gets the byte of row r + n / 8. */
+inline Word rotr_word(const Word w, const int n) {
+    return (w >> n) | (w << (32 - n));
+}
 
-    return v;
+/** out[r] = 2 * a[r] ^ 3 * a[r+1] ^ a[r+2] ^ a[r+3] for all four rows of the column */
+inline Word mix_column_word(const Word w) {
+    const Word r8 = rotr_word(w, 8);
+    return xtime_word(w ^ r8) ^ r8 ^ rotr_word(w, 16) ^ rotr_word(w, 24);
 }
 
 inline void mix_columns(State &state) {
     for (int i = 0; i < kBlockSize; ++i) {
-        const unsigned char v0_1 = (state[i] >>  0) & 0xFF;
-        const unsigned char v1_1 = (state[i] >>  8) & 0xFF;
-        const unsigned char v2_1 = (state[i] >> 16) & 0xFF;
-        const unsigned char v3_1 = (state[i] >> 24) & 0xFF;
-
-        const unsigned char v0_2 = mul2(v0_1);
-        const unsigned char v1_2 = mul2(v1_1);
-        const unsigned char v2_2 = mul2(v2_1);
-        const unsigned char v3_2 = mul2(v3_1);
-
-        const unsigned char v0_3 = v0_2 ^ v0_1;
-        const unsigned char v1_3 = v1_2 ^ v1_1;
-        const unsigned char v2_3 = v2_2 ^ v2_1;
-        const unsigned char v3_3 = v3_2 ^ v3_1;
-
-        state[i] =
-            (v0_2 ^ v1_3 ^ v2_1 ^ v3_1) <<  0 |
-            (v0_1 ^ v1_2 ^ v2_3 ^ v3_1) <<  8 |
-            (v0_1 ^ v1_1 ^ v2_2 ^ v3_3) << 16 |
-            (v0_3 ^ v1_1 ^ v2_1 ^ v3_2) << 24;
+        state[i] = mix_column_word(state[i]);
     }
 }
 
+/**
+ * InvMixColumns is MixColumns after a[r] ^= 4 * (a[r] ^ a[r+2]),
+ * since the inverse matrix factors into the MixColumns matrix and the circulant {05 00 04 00}.
+ */
 inline void inv_mix_columns(State &state) {
     for (int i = 0; i < kBlockSize; ++i) {
-        const unsigned char v0 = (state[i] >>  0) & 0xFF;
-        const unsigned char v1 = (state[i] >>  8) & 0xFF;
-        const unsigned char v2 = (state[i] >> 16) & 0xFF;
-        const unsigned char v3 = (state[i] >> 24) & 0xFF;
-
-        state[i] =
-            (mul(v0, 0x0E) ^ mul(v1, 0x0B) ^ mul(v2, 0x0D) ^ mul(v3, 0x09)) <<  0 |
-            (mul(v0, 0x09) ^ mul(v1, 0x0E) ^ mul(v2, 0x0B) ^ mul(v3, 0x0D)) <<  8 |
-            (mul(v0, 0x0D) ^ mul(v1, 0x09) ^ mul(v2, 0x0E) ^ mul(v3, 0x0B)) << 16 |
-            (mul(v0, 0x0B) ^ mul(v1, 0x0D) ^ mul(v2, 0x09) ^ mul(v3, 0x0E)) << 24;
+        const Word w = state[i];
+        const Word t = xtime_word(xtime_word(w ^ rotr_word(w, 16)));
+        state[i] = mix_column_word(w ^ t);
     }
 }
 
@@ -199,6 +427,7 @@ inline Word rot_word(const Word v) {
 /**
  * @private
  * @throws std::invalid_argument
+ *  With PLUSAES_NO_EXCEPTIONS, returns 0 instead.
  */
 inline unsigned int get_round_count(const int key_size) {
     switch (key_size) {
@@ -209,211 +438,2799 @@ inline unsigned int get_round_count(const int key_size) {
     case 32:
         return 14;
     default:
+#if PLUSAES_NO_EXCEPTIONS
+        return 0;
+#else
         throw std::invalid_argument("Invalid key size");
+#endif
     }
 }
 
-/**
- * @private
- * @throws std::invalid_argument
- */
-inline RoundKeys expand_key(const unsigned char *key, const int key_size) {
-    if (key_size != 16 && key_size != 24 && key_size != 32) {
-        throw std::invalid_argument("Invalid key size");
+#if PLUSAES_HAS_AESNI
+
+inline bool cpuid_1(unsigned int &ecx, unsigned int &edx) {
+#if defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 1);
+    ecx = info[2];
+    edx = info[3];
+#else
+    unsigned int eax = 0, ebx = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
     }
+#endif
+    return true;
+}
 
-    const Word rcon[] = {
-        0x00, 0x01, 0x02, 0x04, 0x08, 0x10,
-        0x20, 0x40, 0x80, 0x1b, 0x36
-    };
+inline bool cpu_has_aesni() {
+    unsigned int ecx = 0, edx = 0;
+    if (!cpuid_1(ecx, edx)) {
+        return false;
+    }
+    return (ecx & (1 << 25)) != 0 && // AES
+           (edx & (1 << 26)) != 0;   // SSE2
+}
 
-    const int nb = kBlockSize;
-    const int nk = key_size / nb;
-    const int nr = get_round_count(key_size);
+inline bool cpu_has_pclmul() {
+    unsigned int ecx = 0, edx = 0;
+    if (!cpuid_1(ecx, edx)) {
+        return false;
+    }
+    return (ecx & (1 << 1)) != 0 && // PCLMULQDQ
+           (ecx & (1 << 9)) != 0;   // SSSE3
+}
 
-    std::vector<Word> w(nb * (nr + 1));
-    for (int i = 0; i < nk; ++ i) {
-        memcpy(&w[i], key + (i * kWordSize), kWordSize);
+/** CPUID is checked only once. */
+inline bool has_aesni() {
+    static const bool has = cpu_has_aesni();
+    return has;
+}
+
+/** True if GCM can use PCLMULQDQ for GHASH together with AES-NI. */
+inline bool has_pclmul() {
+    static const bool has = has_aesni() && cpu_has_pclmul();
+    return has;
+}
+
+inline bool cpu_has_sse2() {
+    unsigned int ecx = 0, edx = 0;
+    if (!cpuid_1(ecx, edx)) {
+        return false;
     }
+    return (edx & (1 << 26)) != 0;
+}
 
-    for (int i = nk; i < nb * (nr + 1); ++i) {
-        Word t = w[i - 1];
-        if (i % nk == 0) {
-            t = sub_word(rot_word(t)) ^ rcon[i / nk];
-        }
-        else if (nk > 6 && i % nk == 4) {
-            t = sub_word(t);
-        }
+inline bool has_sse2() {
+    static const bool has = cpu_has_sse2();
+    return has;
+}
 
-        w[i] = t ^ w[i - nk];
+inline bool cpu_has_ssse3() {
+    unsigned int ecx = 0, edx = 0;
+    if (!cpuid_1(ecx, edx)) {
+        return false;
     }
+    return (ecx & (1 << 9)) != 0;
+}
+
+inline bool has_ssse3() {
+    static const bool has = cpu_has_ssse3();
+    return has;
+}
 
-    RoundKeys keys(nr + 1);
-    memcpy(&keys[0], &w[0], w.size() * kWordSize);
+#if PLUSAES_HAS_AVX2
+/** CPUID leaf 7 and XCR0. False if the CPU or the OS does not support AVX. */
+inline bool cpuid_7(unsigned int &ebx, unsigned int &ecx, unsigned int &xcr0) {
+    unsigned int edx = 0;
+    if (!cpuid_1(ecx, edx) ||
+        (ecx & (1 << 27)) == 0 || // OSXSAVE
+        (ecx & (1 << 28)) == 0) { // AVX
+        return false;
+    }
 
-    return keys;
+#if defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    ebx = info[1];
+    ecx = info[2];
+    xcr0 = static_cast<unsigned int>(_xgetbv(0));
+#else
+    if (__get_cpuid_max(0, 0) < 7) {
+        return false;
+    }
+    unsigned int eax = 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    __asm__ ("xgetbv" : "=a"(xcr0), "=d"(edx) : "c"(0));
+#endif
+    return true;
 }
 
-inline void copy_bytes_to_state(const unsigned char data[16], State &state) {
-    memcpy(&state[0], data +  0, kWordSize);
-    memcpy(&state[1], data +  4, kWordSize);
-    memcpy(&state[2], data +  8, kWordSize);
-    memcpy(&state[3], data + 12, kWordSize);
+inline bool cpu_has_avx2() {
+    unsigned int ebx = 0, ecx = 0, xcr0 = 0;
+    return cpuid_7(ebx, ecx, xcr0) &&
+           (xcr0 & 6) == 6 &&      // the OS saves the XMM and YMM registers
+           (ebx & (1 << 5)) != 0;  // AVX2
 }
 
-inline void copy_state_to_bytes(const State &state, unsigned char buf[16]) {
-    memcpy(buf +  0, &state[0], kWordSize);
-    memcpy(buf +  4, &state[1], kWordSize);
-    memcpy(buf +  8, &state[2], kWordSize);
-    memcpy(buf + 12, &state[3], kWordSize);
+inline bool has_avx2() {
+    static const bool has = cpu_has_avx2();
+    return has;
 }
+#endif
 
-inline void xor_data(unsigned char data[kStateSize], const unsigned char v[kStateSize]) {
-    for (int i = 0; i < kStateSize; ++i) {
-        data[i] ^= v[i];
-    }
+#if PLUSAES_HAS_VAES
+inline bool cpu_has_vaes_avx2() {
+    unsigned int ebx = 0, ecx = 0, xcr0 = 0;
+    return cpuid_7(ebx, ecx, xcr0) &&
+           (xcr0 & 6) == 6 &&
+           (ebx & (1 << 5)) != 0 && // AVX2
+           (ecx & (1 << 9)) != 0;   // VAES
 }
 
-/** increment counter (128-bit int) by 1 */
-inline void incr_counter(unsigned char counter[kStateSize]) {
-    unsigned n = kStateSize, c = 1;
-    do {
-        --n;
-        c += counter[n];
-        counter[n] = c;
-        c >>= 8;
-    } while (n);
+inline bool cpu_has_vaes_avx512() {
+    unsigned int ebx = 0, ecx = 0, xcr0 = 0;
+    return cpuid_7(ebx, ecx, xcr0) &&
+           (xcr0 & 0xE6) == 0xE6 &&  // and the opmask and ZMM registers
+           (ebx & (1 << 16)) != 0 && // AVX-512F
+           (ecx & (1 << 9)) != 0;    // VAES
 }
 
-inline void encrypt_state(const RoundKeys &rkeys, const unsigned char data[16], unsigned char encrypted[16]) {
-    State s;
-    copy_bytes_to_state(data, s);
+/** True if the multi-block paths can use VAES on YMM registers together with AES-NI. */
+inline bool has_vaes_avx2() {
+    static const bool has = has_aesni() && cpu_has_vaes_avx2();
+    return has;
+}
 
-    add_round_key(rkeys[0], s);
+/** True if the multi-block paths can use VAES on ZMM registers together with AES-NI. */
+inline bool has_vaes_avx512() {
+    static const bool has = has_aesni() && cpu_has_vaes_avx512();
+    return has;
+}
+#endif
 
-    for (unsigned int i = 1; i < rkeys.size() - 1; ++i) {
-        sub_bytes(s);
-        shift_rows(s);
-        mix_columns(s);
-        add_round_key(rkeys[i], s);
-    }
+PLUSAES_TARGET_AESNI
+inline __m128i aesni_load(const void *p) {
+    return _mm_loadu_si128(static_cast<const __m128i *>(p));
+}
 
-    sub_bytes(s);
-    shift_rows(s);
-    add_round_key(rkeys.back(), s);
+PLUSAES_TARGET_AESNI
+inline void aesni_store(void *p, const __m128i v) {
+    _mm_storeu_si128(static_cast<__m128i *>(p), v);
+}
 
-    copy_state_to_bytes(s, encrypted);
+/** w0 ^ w1 ^ w2 ^ w3 running xor of the previous round key, plus the assist word */
+PLUSAES_TARGET_AESNI
+inline __m128i aesni_expand_step(__m128i k, const __m128i assist) {
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 8));
+    return _mm_xor_si128(k, assist);
 }
 
-inline void decrypt_state(const RoundKeys &rkeys, const unsigned char data[16], unsigned char decrypted[16]) {
-    State s;
-    copy_bytes_to_state(data, s);
+template<int Rcon>
+PLUSAES_TARGET_AESNI
+inline __m128i aesni_expand_128(const __m128i k) {
+    return aesni_expand_step(k, _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k, Rcon), 0xFF));
+}
 
-    add_round_key(rkeys.back(), s);
-    inv_shift_rows(s);
-    inv_sub_bytes(s);
+/** Expands 192-bit key: k0 has 4 words, k1 has 2 words (upper 64-bit is don't care). */
+template<int Rcon>
+PLUSAES_TARGET_AESNI
+inline void aesni_expand_192(__m128i &k0, __m128i &k1) {
+    k0 = aesni_expand_step(k0, _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k1, Rcon), 0x55));
+    k1 = _mm_xor_si128(k1, _mm_slli_si128(k1, 4));
+    k1 = _mm_xor_si128(k1, _mm_shuffle_epi32(k0, 0xFF));
+}
 
-    for (std::size_t i = rkeys.size() - 2; i > 0; --i) {
-        add_round_key(rkeys[i], s);
-        inv_mix_columns(s);
-        inv_shift_rows(s);
-        inv_sub_bytes(s);
-    }
+template<int Rcon>
+PLUSAES_TARGET_AESNI
+inline __m128i aesni_expand_256_even(const __m128i k0, const __m128i k1) {
+    return aesni_expand_step(k0, _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k1, Rcon), 0xFF));
+}
 
-    add_round_key(rkeys[0], s);
+PLUSAES_TARGET_AESNI
+inline __m128i aesni_expand_256_odd(const __m128i k0, const __m128i k1) {
+    return aesni_expand_step(k1, _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k0, 0x00), 0xAA));
+}
 
-    copy_state_to_bytes(s, decrypted);
+PLUSAES_TARGET_AESNI
+inline __m128i aesni_concat_lo(const __m128i lo, const __m128i hi) {
+    return _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(lo), _mm_castsi128_pd(hi), 0));
 }
 
-template<int KeyLen>
-std::vector<unsigned char> key_from_string(const char (*key_str)[KeyLen]) {
-    std::vector<unsigned char> key(KeyLen - 1);
-    memcpy(&key[0], *key_str, KeyLen - 1);
-    return key;
+PLUSAES_TARGET_AESNI
+inline __m128i aesni_concat_hi_lo(const __m128i hi, const __m128i lo) {
+    return _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(hi), _mm_castsi128_pd(lo), 1));
 }
 
-inline bool is_valid_key_size(const unsigned long key_size) {
-    if (key_size != 16 && key_size != 24 && key_size != 32) {
-        return false;
+/** Key expansion by aeskeygenassist. The key size must be valid. */
+PLUSAES_TARGET_AESNI
+inline void aesni_expand_key(const unsigned char *key, const int key_size, RoundKeys &keys) {
+    __m128i *ks = reinterpret_cast<__m128i *>(&keys[0]);
+
+    if (key_size == 16) {
+        __m128i k = aesni_load(key);
+        aesni_store(ks + 0, k);
+        k = aesni_expand_128<0x01>(k); aesni_store(ks +  1, k);
+        k = aesni_expand_128<0x02>(k); aesni_store(ks +  2, k);
+        k = aesni_expand_128<0x04>(k); aesni_store(ks +  3, k);
+        k = aesni_expand_128<0x08>(k); aesni_store(ks +  4, k);
+        k = aesni_expand_128<0x10>(k); aesni_store(ks +  5, k);
+        k = aesni_expand_128<0x20>(k); aesni_store(ks +  6, k);
+        k = aesni_expand_128<0x40>(k); aesni_store(ks +  7, k);
+        k = aesni_expand_128<0x80>(k); aesni_store(ks +  8, k);
+        k = aesni_expand_128<0x1B>(k); aesni_store(ks +  9, k);
+        k = aesni_expand_128<0x36>(k); aesni_store(ks + 10, k);
+    }
+    else if (key_size == 24) {
+        __m128i k0 = aesni_load(key);
+        __m128i k1 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(key + 16));
+        __m128i t = k1;
+        aesni_store(ks + 0, k0);
+        aesni_expand_192<0x01>(k0, k1);
+        aesni_store(ks + 1, aesni_concat_lo(t, k0));
+        aesni_store(ks + 2, aesni_concat_hi_lo(k0, k1));
+        aesni_expand_192<0x02>(k0, k1);
+        aesni_store(ks + 3, k0);
+        t = k1;
+        aesni_expand_192<0x04>(k0, k1);
+        aesni_store(ks + 4, aesni_concat_lo(t, k0));
+        aesni_store(ks + 5, aesni_concat_hi_lo(k0, k1));
+        aesni_expand_192<0x08>(k0, k1);
+        aesni_store(ks + 6, k0);
+        t = k1;
+        aesni_expand_192<0x10>(k0, k1);
+        aesni_store(ks + 7, aesni_concat_lo(t, k0));
+        aesni_store(ks + 8, aesni_concat_hi_lo(k0, k1));
+        aesni_expand_192<0x20>(k0, k1);
+        aesni_store(ks + 9, k0);
+        t = k1;
+        aesni_expand_192<0x40>(k0, k1);
+        aesni_store(ks + 10, aesni_concat_lo(t, k0));
+        aesni_store(ks + 11, aesni_concat_hi_lo(k0, k1));
+        aesni_expand_192<0x80>(k0, k1);
+        aesni_store(ks + 12, k0);
     }
     else {
-        return true;
+        __m128i k0 = aesni_load(key);
+        __m128i k1 = aesni_load(key + 16);
+        aesni_store(ks + 0, k0);
+        aesni_store(ks + 1, k1);
+        k0 = aesni_expand_256_even<0x01>(k0, k1); aesni_store(ks +  2, k0);
+        k1 = aesni_expand_256_odd(k0, k1);        aesni_store(ks +  3, k1);
+        k0 = aesni_expand_256_even<0x02>(k0, k1); aesni_store(ks +  4, k0);
+        k1 = aesni_expand_256_odd(k0, k1);        aesni_store(ks +  5, k1);
+        k0 = aesni_expand_256_even<0x04>(k0, k1); aesni_store(ks +  6, k0);
+        k1 = aesni_expand_256_odd(k0, k1);        aesni_store(ks +  7, k1);
+        k0 = aesni_expand_256_even<0x08>(k0, k1); aesni_store(ks +  8, k0);
+        k1 = aesni_expand_256_odd(k0, k1);        aesni_store(ks +  9, k1);
+        k0 = aesni_expand_256_even<0x10>(k0, k1); aesni_store(ks + 10, k0);
+        k1 = aesni_expand_256_odd(k0, k1);        aesni_store(ks + 11, k1);
+        k0 = aesni_expand_256_even<0x20>(k0, k1); aesni_store(ks + 12, k0);
+        k1 = aesni_expand_256_odd(k0, k1);        aesni_store(ks + 13, k1);
+        k0 = aesni_expand_256_even<0x40>(k0, k1); aesni_store(ks + 14, k0);
     }
 }
 
-} // namespace detail
+/** Nr is a compile-time constant, so the rounds are unrolled and the round keys can stay in registers. */
+template<int Nr>
+PLUSAES_TARGET_AESNI
+inline void aesni_encrypt_state_nr(const RoundKeys &rkeys, const unsigned char data[16], unsigned char encrypted[16]) {
+    const __m128i *rk = reinterpret_cast<const __m128i *>(&rkeys[0]);
 
-/** Version number of plusaes. */
-inline unsigned int version() {
-    return PLUSAES_VERSION;
+    __m128i s = _mm_xor_si128(aesni_load(data), aesni_load(rk));
+    for (int i = 1; i < Nr; ++i) {
+        s = _mm_aesenc_si128(s, aesni_load(rk + i));
+    }
+    s = _mm_aesenclast_si128(s, aesni_load(rk + Nr));
+
+    aesni_store(encrypted, s);
 }
 
-/** Create 128-bit key from string. */
-inline std::vector<unsigned char> key_from_string(const char (*key_str)[17]) {
-    return detail::key_from_string<17>(key_str);
+PLUSAES_TARGET_AESNI
+inline void aesni_encrypt_state(const RoundKeys &rkeys, const unsigned char data[16], unsigned char encrypted[16]) {
+    switch (get_rounds(rkeys)) {
+    case 10: aesni_encrypt_state_nr<10>(rkeys, data, encrypted); break;
+    case 12: aesni_encrypt_state_nr<12>(rkeys, data, encrypted); break;
+    default: aesni_encrypt_state_nr<14>(rkeys, data, encrypted); break;
+    }
 }
 
-/** Create 192-bit key from string. */
-inline std::vector<unsigned char> key_from_string(const char (*key_str)[25]) {
-    return detail::key_from_string<25>(key_str);
+/** aesdec implements the equivalent inverse cipher, so it takes the decryption round keys. */
+template<int Nr>
+PLUSAES_TARGET_AESNI
+inline void aesni_decrypt_state_nr(const RoundKeys &dkeys, const unsigned char data[16], unsigned char decrypted[16]) {
+    const __m128i *dk = reinterpret_cast<const __m128i *>(&dkeys[0]);
+
+    __m128i s = _mm_xor_si128(aesni_load(data), aesni_load(dk + Nr));
+    for (int i = Nr - 1; i > 0; --i) {
+        s = _mm_aesdec_si128(s, aesni_load(dk + i));
+    }
+    s = _mm_aesdeclast_si128(s, aesni_load(dk));
+
+    aesni_store(decrypted, s);
 }
 
-/** Create 256-bit key from string. */
-inline std::vector<unsigned char> key_from_string(const char (*key_str)[33]) {
-    return detail::key_from_string<33>(key_str);
+PLUSAES_TARGET_AESNI
+inline void aesni_decrypt_state(const RoundKeys &dkeys, const unsigned char data[16], unsigned char decrypted[16]) {
+    switch (get_rounds(dkeys)) {
+    case 10: aesni_decrypt_state_nr<10>(dkeys, data, decrypted); break;
+    case 12: aesni_decrypt_state_nr<12>(dkeys, data, decrypted); break;
+    default: aesni_decrypt_state_nr<14>(dkeys, data, decrypted); break;
+    }
 }
 
-/** Calculates encrypted data size when padding is enabled. */
-inline unsigned long get_padded_encrypted_size(const unsigned long data_size) {
-    return data_size + detail::kStateSize - (data_size % detail::kStateSize);
+/** InvMixColumns of the middle round keys by aesimc. */
+PLUSAES_TARGET_AESNI
+inline void aesni_inv_mix_round_keys(RoundKeys &keys) {
+    __m128i *k = reinterpret_cast<__m128i *>(&keys[0]);
+    for (std::size_t i = 1; i + 1 < keys.size(); ++i) {
+        aesni_store(k + i, _mm_aesimc_si128(aesni_load(k + i)));
+    }
 }
 
-/** Error code */
-typedef enum {
-    kErrorOk = 0,
-    kErrorInvalidDataSize = 1,
-    kErrorInvalidKeySize,
-    kErrorInvalidBufferSize,
-    kErrorInvalidKey,
-    kErrorInvalidNonceSize
-} Error;
+/** Number of blocks the AES-NI kernels keep in flight. */
+const int kAesniParallelBlocks = 8;
 
-namespace detail {
+PLUSAES_TARGET_AESNI
+inline void aesni_xor8(__m128i b[8], const __m128i k) {
+    b[0] = _mm_xor_si128(b[0], k); b[1] = _mm_xor_si128(b[1], k);
+    b[2] = _mm_xor_si128(b[2], k); b[3] = _mm_xor_si128(b[3], k);
+    b[4] = _mm_xor_si128(b[4], k); b[5] = _mm_xor_si128(b[5], k);
+    b[6] = _mm_xor_si128(b[6], k); b[7] = _mm_xor_si128(b[7], k);
+}
 
-inline Error check_encrypt_cond(
-    const unsigned long data_size,
-    const unsigned long key_size,
-    const unsigned long encrypted_size,
-    const bool pads) {
-    // check data size
-    if (!pads && (data_size % kStateSize != 0)) {
-        return kErrorInvalidDataSize;
-    }
+PLUSAES_TARGET_AESNI
+inline void aesni_enc8(__m128i b[8], const __m128i k) {
+    b[0] = _mm_aesenc_si128(b[0], k); b[1] = _mm_aesenc_si128(b[1], k);
+    b[2] = _mm_aesenc_si128(b[2], k); b[3] = _mm_aesenc_si128(b[3], k);
+    b[4] = _mm_aesenc_si128(b[4], k); b[5] = _mm_aesenc_si128(b[5], k);
+    b[6] = _mm_aesenc_si128(b[6], k); b[7] = _mm_aesenc_si128(b[7], k);
+}
 
-    // check key size
-    if (!detail::is_valid_key_size(key_size)) {
-        return kErrorInvalidKeySize;
+PLUSAES_TARGET_AESNI
+inline void aesni_enclast8(__m128i b[8], const __m128i k) {
+    b[0] = _mm_aesenclast_si128(b[0], k); b[1] = _mm_aesenclast_si128(b[1], k);
+    b[2] = _mm_aesenclast_si128(b[2], k); b[3] = _mm_aesenclast_si128(b[3], k);
+    b[4] = _mm_aesenclast_si128(b[4], k); b[5] = _mm_aesenclast_si128(b[5], k);
+    b[6] = _mm_aesenclast_si128(b[6], k); b[7] = _mm_aesenclast_si128(b[7], k);
+}
+
+PLUSAES_TARGET_AESNI
+inline void aesni_dec8(__m128i b[8], const __m128i k) {
+    b[0] = _mm_aesdec_si128(b[0], k); b[1] = _mm_aesdec_si128(b[1], k);
+    b[2] = _mm_aesdec_si128(b[2], k); b[3] = _mm_aesdec_si128(b[3], k);
+    b[4] = _mm_aesdec_si128(b[4], k); b[5] = _mm_aesdec_si128(b[5], k);
+    b[6] = _mm_aesdec_si128(b[6], k); b[7] = _mm_aesdec_si128(b[7], k);
+}
+
+PLUSAES_TARGET_AESNI
+inline void aesni_declast8(__m128i b[8], const __m128i k) {
+    b[0] = _mm_aesdeclast_si128(b[0], k); b[1] = _mm_aesdeclast_si128(b[1], k);
+    b[2] = _mm_aesdeclast_si128(b[2], k); b[3] = _mm_aesdeclast_si128(b[3], k);
+    b[4] = _mm_aesdeclast_si128(b[4], k); b[5] = _mm_aesdeclast_si128(b[5], k);
+    b[6] = _mm_aesdeclast_si128(b[6], k); b[7] = _mm_aesdeclast_si128(b[7], k);
+}
+
+template<int Nr>
+PLUSAES_TARGET_AESNI
+inline void aesni_encrypt_blocks_nr(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    __m128i rk[Nr + 1];
+    for (int i = 0; i <= Nr; ++i) {
+        rk[i] = aesni_load(&rkeys[i]);
     }
 
-    // check encrypted buffer size
-    if (pads) {
-        const unsigned long required_size = get_padded_encrypted_size(data_size);
-        if (encrypted_size < required_size) {
-            return kErrorInvalidBufferSize;
+    for (; nblocks >= kAesniParallelBlocks; nblocks -= kAesniParallelBlocks) {
+        __m128i b[kAesniParallelBlocks];
+        for (int j = 0; j < kAesniParallelBlocks; ++j) {
+            b[j] = aesni_load(in + j * 16);
+        }
+
+        aesni_xor8(b, rk[0]);
+        for (int i = 1; i < Nr; ++i) {
+            aesni_enc8(b, rk[i]);
+        }
+        aesni_enclast8(b, rk[Nr]);
+
+        for (int j = 0; j < kAesniParallelBlocks; ++j) {
+            aesni_store(out + j * 16, b[j]);
         }
+        in += kAesniParallelBlocks * 16;
+        out += kAesniParallelBlocks * 16;
     }
-    else {
-        if (encrypted_size < data_size) {
-            return kErrorInvalidBufferSize;
+
+    for (; nblocks > 0; --nblocks) {
+        __m128i b = _mm_xor_si128(aesni_load(in), rk[0]);
+        for (int i = 1; i < Nr; ++i) {
+            b = _mm_aesenc_si128(b, rk[i]);
         }
+        aesni_store(out, _mm_aesenclast_si128(b, rk[Nr]));
+        in += 16;
+        out += 16;
     }
-    return kErrorOk;
 }
 
-inline Error check_decrypt_cond(
-    const unsigned long data_size,
-    const unsigned long key_size,
-    const unsigned long decrypted_size,
+PLUSAES_TARGET_AESNI
+inline void aesni_encrypt_blocks(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    switch (get_rounds(rkeys)) {
+    case 10: aesni_encrypt_blocks_nr<10>(rkeys, in, out, nblocks); break;
+    case 12: aesni_encrypt_blocks_nr<12>(rkeys, in, out, nblocks); break;
+    default: aesni_encrypt_blocks_nr<14>(rkeys, in, out, nblocks); break;
+    }
+}
+
+template<int Nr>
+PLUSAES_TARGET_AESNI
+inline void aesni_decrypt_blocks_nr(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    __m128i dk[Nr + 1];
+    for (int i = 0; i <= Nr; ++i) {
+        dk[i] = aesni_load(&dkeys[i]);
+    }
+
+    for (; nblocks >= kAesniParallelBlocks; nblocks -= kAesniParallelBlocks) {
+        __m128i b[kAesniParallelBlocks];
+        for (int j = 0; j < kAesniParallelBlocks; ++j) {
+            b[j] = aesni_load(in + j * 16);
+        }
+
+        aesni_xor8(b, dk[Nr]);
+        for (int i = Nr - 1; i > 0; --i) {
+            aesni_dec8(b, dk[i]);
+        }
+        aesni_declast8(b, dk[0]);
+
+        for (int j = 0; j < kAesniParallelBlocks; ++j) {
+            aesni_store(out + j * 16, b[j]);
+        }
+        in += kAesniParallelBlocks * 16;
+        out += kAesniParallelBlocks * 16;
+    }
+
+    for (; nblocks > 0; --nblocks) {
+        __m128i b = _mm_xor_si128(aesni_load(in), dk[Nr]);
+        for (int i = Nr - 1; i > 0; --i) {
+            b = _mm_aesdec_si128(b, dk[i]);
+        }
+        aesni_store(out, _mm_aesdeclast_si128(b, dk[0]));
+        in += 16;
+        out += 16;
+    }
+}
+
+PLUSAES_TARGET_AESNI
+inline void aesni_decrypt_blocks(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    switch (get_rounds(dkeys)) {
+    case 10: aesni_decrypt_blocks_nr<10>(dkeys, in, out, nblocks); break;
+    case 12: aesni_decrypt_blocks_nr<12>(dkeys, in, out, nblocks); break;
+    default: aesni_decrypt_blocks_nr<14>(dkeys, in, out, nblocks); break;
+    }
+}
+
+#if PLUSAES_HAS_VAES
+
+// VAES kernels
+//
+// vaesenc runs an AES round on each 128-bit lane, so a YMM register holds 2 blocks
+// and a ZMM register 4 blocks. The generic kernel keeps kAesniParallelBlocks registers
+// in flight like the AES-NI kernels and goes through a buffer for the last partial register.
+
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_load(const unsigned char *p, __m256i &v) { v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_store(unsigned char *p, const __m256i &v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v); }
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_broadcast(const RoundKey &k, __m256i &v) { v = _mm256_broadcastsi128_si256(aesni_load(&k)); }
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_xor(__m256i &b, const __m256i &k) { b = _mm256_xor_si256(b, k); }
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_enc(__m256i &b, const __m256i &k) { b = _mm256_aesenc_epi128(b, k); }
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_enclast(__m256i &b, const __m256i &k) { b = _mm256_aesenclast_epi128(b, k); }
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_dec(__m256i &b, const __m256i &k) { b = _mm256_aesdec_epi128(b, k); }
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_declast(__m256i &b, const __m256i &k) { b = _mm256_aesdeclast_epi128(b, k); }
+
+PLUSAES_TARGET_VAES_AVX512
+inline void vaes_load(const unsigned char *p, __m512i &v) { v = _mm512_loadu_si512(p); }
+PLUSAES_TARGET_VAES_AVX512
+inline void vaes_store(unsigned char *p, const __m512i &v) { _mm512_storeu_si512(p, v); }
+PLUSAES_TARGET_VAES_AVX512
+inline void vaes_broadcast(const RoundKey &k, __m512i &v) { v = _mm512_maskz_broadcast_i32x4(0xFFFF, aesni_load(&k)); }
+PLUSAES_TARGET_VAES_AVX512
+inline void vaes_xor(__m512i &b, const __m512i &k) { b = _mm512_xor_si512(b, k); }
+PLUSAES_TARGET_VAES_AVX512
+inline void vaes_enc(__m512i &b, const __m512i &k) { b = _mm512_aesenc_epi128(b, k); }
+PLUSAES_TARGET_VAES_AVX512
+inline void vaes_enclast(__m512i &b, const __m512i &k) { b = _mm512_aesenclast_epi128(b, k); }
+PLUSAES_TARGET_VAES_AVX512
+inline void vaes_dec(__m512i &b, const __m512i &k) { b = _mm512_aesdec_epi128(b, k); }
+PLUSAES_TARGET_VAES_AVX512
+inline void vaes_declast(__m512i &b, const __m512i &k) { b = _mm512_aesdeclast_epi128(b, k); }
+
+/** A middle round, or the last one with Last, on a register in place. */
+template<typename V, bool Encrypts, bool Last>
+PLUSAES_FORCE_INLINE void vaes_round(V &b, const V &k) {
+    if (Encrypts) {
+        if (Last) vaes_enclast(b, k);
+        else vaes_enc(b, k);
+    }
+    else {
+        if (Last) vaes_declast(b, k);
+        else vaes_dec(b, k);
+    }
+}
+
+template<typename V, bool Encrypts, bool Last>
+PLUSAES_FORCE_INLINE void vaes_round8(V b[8], const V &k) {
+    vaes_round<V, Encrypts, Last>(b[0], k); vaes_round<V, Encrypts, Last>(b[1], k);
+    vaes_round<V, Encrypts, Last>(b[2], k); vaes_round<V, Encrypts, Last>(b[3], k);
+    vaes_round<V, Encrypts, Last>(b[4], k); vaes_round<V, Encrypts, Last>(b[5], k);
+    vaes_round<V, Encrypts, Last>(b[6], k); vaes_round<V, Encrypts, Last>(b[7], k);
+}
+
+/** Runs the rounds on a register in place; the round keys are in the order they are applied. */
+template<typename V, int Nr, bool Encrypts>
+PLUSAES_FORCE_INLINE void vaes_crypt(V &b, const V k[Nr + 1]) {
+    vaes_xor(b, k[0]);
+    for (int i = 1; i < Nr; ++i) {
+        vaes_round<V, Encrypts, false>(b, k[i]);
+    }
+    vaes_round<V, Encrypts, true>(b, k[Nr]);
+}
+
+/** Decryption takes the decryption round keys (expand_decrypt_key) and applies them from the last one. */
+template<typename V, int Nr, bool Encrypts>
+PLUSAES_FORCE_INLINE void vaes_crypt_blocks_nr(const RoundKeys &keys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    const std::size_t lane_blocks = sizeof(V) / kStateSize;
+    const std::size_t group_blocks = kAesniParallelBlocks * lane_blocks;
+
+    V k[Nr + 1];
+    for (int i = 0; i <= Nr; ++i) {
+        vaes_broadcast(keys[Encrypts ? i : Nr - i], k[i]);
+    }
+
+    for (; nblocks >= group_blocks; nblocks -= group_blocks) {
+        V b[kAesniParallelBlocks];
+        for (int j = 0; j < kAesniParallelBlocks; ++j) {
+            vaes_load(in + j * sizeof(V), b[j]);
+            vaes_xor(b[j], k[0]);
+        }
+        for (int i = 1; i < Nr; ++i) {
+            vaes_round8<V, Encrypts, false>(b, k[i]);
+        }
+        vaes_round8<V, Encrypts, true>(b, k[Nr]);
+        for (int j = 0; j < kAesniParallelBlocks; ++j) {
+            vaes_store(out + j * sizeof(V), b[j]);
+        }
+        in += group_blocks * kStateSize;
+        out += group_blocks * kStateSize;
+    }
+
+    for (; nblocks >= lane_blocks; nblocks -= lane_blocks) {
+        V b;
+        vaes_load(in, b);
+        vaes_crypt<V, Nr, Encrypts>(b, k);
+        vaes_store(out, b);
+        in += sizeof(V);
+        out += sizeof(V);
+    }
+
+    if (nblocks > 0) {
+        unsigned char buf[sizeof(V)] = {};
+        memcpy(buf, in, nblocks * kStateSize);
+        V b;
+        vaes_load(buf, b);
+        vaes_crypt<V, Nr, Encrypts>(b, k);
+        vaes_store(buf, b);
+        memcpy(out, buf, nblocks * kStateSize);
+    }
+}
+
+template<typename V, bool Encrypts>
+PLUSAES_FORCE_INLINE void vaes_crypt_blocks(const RoundKeys &keys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    switch (get_rounds(keys)) {
+    case 10: vaes_crypt_blocks_nr<V, 10, Encrypts>(keys, in, out, nblocks); break;
+    case 12: vaes_crypt_blocks_nr<V, 12, Encrypts>(keys, in, out, nblocks); break;
+    default: vaes_crypt_blocks_nr<V, 14, Encrypts>(keys, in, out, nblocks); break;
+    }
+}
+
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_avx2_encrypt_blocks(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    vaes_crypt_blocks<__m256i, true>(rkeys, in, out, nblocks);
+}
+
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_avx2_decrypt_blocks(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    vaes_crypt_blocks<__m256i, false>(dkeys, in, out, nblocks);
+}
+
+PLUSAES_TARGET_VAES_AVX512
+inline void vaes_avx512_encrypt_blocks(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    vaes_crypt_blocks<__m512i, true>(rkeys, in, out, nblocks);
+}
+
+PLUSAES_TARGET_VAES_AVX512
+inline void vaes_avx512_decrypt_blocks(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    vaes_crypt_blocks<__m512i, false>(dkeys, in, out, nblocks);
+}
+
+/**
+ * Takes the widest VAES registers the CPU has. Fewer blocks than one register go to AES-NI.
+ * @return false if the CPU has no VAES.
+ */
+inline bool vaes_crypt_blocks(const RoundKeys &keys, const unsigned char *in, unsigned char *out, std::size_t nblocks, const bool encrypts) {
+    if (nblocks >= sizeof(__m512i) / kStateSize && has_vaes_avx512()) {
+        if (encrypts) vaes_avx512_encrypt_blocks(keys, in, out, nblocks);
+        else vaes_avx512_decrypt_blocks(keys, in, out, nblocks);
+        return true;
+    }
+    if (nblocks >= sizeof(__m256i) / kStateSize && has_vaes_avx2()) {
+        if (encrypts) vaes_avx2_encrypt_blocks(keys, in, out, nblocks);
+        else vaes_avx2_decrypt_blocks(keys, in, out, nblocks);
+        return true;
+    }
+    return false;
+}
+
+#endif // PLUSAES_HAS_VAES
+
+#endif // PLUSAES_HAS_AESNI
+
+// Bitsliced rounds
+//
+// A slice word W holds one bit of every state byte of N blocks: q[i] has bit i,
+// and byte (row, col) of block b is bit (row * 4 + col) * N + b.
+// A row is then 4 * N contiguous bits, so ShiftRows rotates inside a row and
+// MixColumns rotates whole rows. The S-box is the circuit of Boyar and Peralta
+// (https://eprint.iacr.org/2009/191), so no memory access depends on the data.
+// The slice words are uint64_t (4 blocks), __m128i (8 blocks) and __m256i (16 blocks).
+
+inline void bs_swap_move(uint64_t &a, uint64_t &b, const int n, const uint64_t m) {
+    const uint64_t t = ((a >> n) ^ b) & m;
+    b ^= t;
+    a ^= t << n;
+}
+
+/** Transposes the 8x8 bit matrices of q[0..7] and the bits of each byte. It is its own inverse. */
+inline void bs_ortho(uint64_t q[8]) {
+    const uint64_t m1 = 0x55555555 * ((static_cast<uint64_t>(1) << 32) + 1);
+    const uint64_t m2 = 0x33333333 * ((static_cast<uint64_t>(1) << 32) + 1);
+    const uint64_t m4 = 0x0F0F0F0F * ((static_cast<uint64_t>(1) << 32) + 1);
+    for (int i = 0; i < 8; i += 2) {
+        bs_swap_move(q[i], q[i + 1], 1, m1);
+    }
+    for (int i = 0; i < 4; ++i) {
+        bs_swap_move(q[i + (i & 2)], q[i + (i & 2) + 2], 2, m2);
+    }
+    for (int i = 0; i < 4; ++i) {
+        bs_swap_move(q[i], q[i + 4], 4, m4);
+    }
+}
+
+/** Moves byte r of a column word to byte 2 * r. */
+inline uint64_t bs_spread_bytes(const uint32_t w) {
+    uint64_t x = w;
+    x = (x | (x << 16)) & ((static_cast<uint64_t>(0xFFFF) << 32) | 0xFFFF);
+    x = (x | (x <<  8)) & (static_cast<uint64_t>(0x00FF00FF) * ((static_cast<uint64_t>(1) << 32) + 1));
+    return x;
+}
+
+inline uint32_t bs_compact_bytes(uint64_t x) {
+    x &= static_cast<uint64_t>(0x00FF00FF) * ((static_cast<uint64_t>(1) << 32) + 1);
+    x = (x | (x >>  8)) & ((static_cast<uint64_t>(0xFFFF) << 32) | 0xFFFF);
+    x = (x | (x >> 16));
+    return static_cast<uint32_t>(x);
+}
+
+inline uint32_t bs_load_le32(const unsigned char *p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+inline void bs_store_le32(unsigned char *p, const uint32_t v) {
+    p[0] = static_cast<unsigned char>(v);
+    p[1] = static_cast<unsigned char>(v >> 8);
+    p[2] = static_cast<unsigned char>(v >> 16);
+    p[3] = static_cast<unsigned char>(v >> 24);
+}
+
+/**
+ * Packs 4 blocks, stride bytes apart (0 broadcasts one block).
+ * q[p * 4 + b] gets columns p and p + 2 of block b with their bytes interleaved,
+ * so that bit k of byte (row * 2 + col / 2) is bit (row * 4 + col) * 4 + b after bs_ortho.
+ */
+inline void bs_pack_u64(const unsigned char *in, const std::size_t stride, uint64_t q[8]) {
+    for (int b = 0; b < 4; ++b) {
+        const unsigned char *p = in + b * stride;
+        q[b]     = bs_spread_bytes(bs_load_le32(p + 0)) | bs_spread_bytes(bs_load_le32(p +  8)) << 8;
+        q[b + 4] = bs_spread_bytes(bs_load_le32(p + 4)) | bs_spread_bytes(bs_load_le32(p + 12)) << 8;
+    }
+    bs_ortho(q);
+}
+
+inline void bs_pack(const unsigned char *in, uint64_t q[8]) {
+    bs_pack_u64(in, kStateSize, q);
+}
+
+inline void bs_unpack(uint64_t q[8], unsigned char *out) {
+    bs_ortho(q);
+    for (int b = 0; b < 4; ++b) {
+        unsigned char *p = out + b * kStateSize;
+        bs_store_le32(p +  0, bs_compact_bytes(q[b]));
+        bs_store_le32(p +  8, bs_compact_bytes(q[b] >> 8));
+        bs_store_le32(p +  4, bs_compact_bytes(q[b + 4]));
+        bs_store_le32(p + 12, bs_compact_bytes(q[b + 4] >> 8));
+    }
+}
+
+inline void bs_load_key(const unsigned char key[16], uint64_t q[8]) {
+    bs_pack_u64(key, 0, q);
+}
+
+inline void bs_shift_rows(uint64_t q[8]) {
+    for (int i = 0; i < 8; ++i) {
+        const uint64_t x = q[i];
+        q[i] = (x & 0xFFFF) |
+               ((x & 0xFFF00000) >> 4) | ((x & 0x000F0000) << 12) |
+               ((x & (static_cast<uint64_t>(0xFF00) << 32)) >> 8) | ((x & (static_cast<uint64_t>(0x00FF) << 32)) << 8) |
+               ((x & (static_cast<uint64_t>(0xF0000000) << 32)) >> 12) | ((x & (static_cast<uint64_t>(0x0FFF0000) << 32)) << 4);
+    }
+}
+
+inline void bs_inv_shift_rows(uint64_t q[8]) {
+    for (int i = 0; i < 8; ++i) {
+        const uint64_t x = q[i];
+        q[i] = (x & 0xFFFF) |
+               ((x & 0x0FFF0000) << 4) | ((x & 0xF0000000) >> 12) |
+               ((x & (static_cast<uint64_t>(0xFF00) << 32)) >> 8) | ((x & (static_cast<uint64_t>(0x00FF) << 32)) << 8) |
+               ((x & (static_cast<uint64_t>(0x000F0000) << 32)) << 12) | ((x & (static_cast<uint64_t>(0xFFF00000) << 32)) >> 4);
+    }
+}
+
+/** Row r of out gets row r + 1 of in. */
+inline void bs_rotate_rows1(const uint64_t in[8], uint64_t out[8]) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = (in[i] >> 16) | (in[i] << 48);
+    }
+}
+
+/** Row r of out gets row r + 2 of in. */
+inline void bs_rotate_rows2(const uint64_t in[8], uint64_t out[8]) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = (in[i] >> 32) | (in[i] << 32);
+    }
+}
+
+#if PLUSAES_HAS_AESNI
+
+#if defined(_MSC_VER) && !defined(__clang__)
+// GCC and Clang have these operators for vector types.
+inline __m128i operator^(const __m128i a, const __m128i b) { return _mm_xor_si128(a, b); }
+inline __m128i operator&(const __m128i a, const __m128i b) { return _mm_and_si128(a, b); }
+inline __m128i operator~(const __m128i a) { return _mm_xor_si128(a, _mm_set1_epi32(-1)); }
+#if PLUSAES_HAS_AVX2
+inline __m256i operator^(const __m256i a, const __m256i b) { return _mm256_xor_si256(a, b); }
+inline __m256i operator&(const __m256i a, const __m256i b) { return _mm256_and_si256(a, b); }
+inline __m256i operator~(const __m256i a) { return _mm256_xor_si256(a, _mm256_set1_epi32(-1)); }
+#endif
+#endif
+
+/** Transposes the bytes of a block as a 4x4 matrix: byte (row * 4 + col) gets state byte (col * 4 + row). */
+PLUSAES_TARGET_SSE2
+inline __m128i bs_transpose_bytes(const __m128i x) {
+    const __m128i y = _mm_unpacklo_epi8(x, _mm_srli_si128(x, 8));
+    return _mm_unpacklo_epi8(y, _mm_srli_si128(y, 8));
+}
+
+template<int N>
+PLUSAES_TARGET_SSE2
+inline void bs_swap_move(__m128i &a, __m128i &b, const __m128i m) {
+    const __m128i t = _mm_and_si128(_mm_xor_si128(_mm_srli_epi64(a, N), b), m);
+    b = _mm_xor_si128(b, t);
+    a = _mm_xor_si128(a, _mm_slli_epi64(t, N));
+}
+
+PLUSAES_TARGET_SSE2
+inline void bs_ortho(__m128i q[8]) {
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0F);
+    for (int i = 0; i < 8; i += 2) {
+        bs_swap_move<1>(q[i], q[i + 1], m1);
+    }
+    for (int i = 0; i < 4; ++i) {
+        bs_swap_move<2>(q[i + (i & 2)], q[i + (i & 2) + 2], m2);
+    }
+    for (int i = 0; i < 4; ++i) {
+        bs_swap_move<4>(q[i], q[i + 4], m4);
+    }
+}
+
+/** Byte k of q[b] is byte k of block b after the transpose, so a byte holds one state byte of the 8 blocks after bs_ortho. */
+PLUSAES_TARGET_SSE2
+inline void bs_pack(const unsigned char *in, __m128i q[8]) {
+    for (int b = 0; b < 8; ++b) {
+        q[b] = bs_transpose_bytes(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + b * kStateSize)));
+    }
+    bs_ortho(q);
+}
+
+PLUSAES_TARGET_SSE2
+inline void bs_unpack(__m128i q[8], unsigned char *out) {
+    bs_ortho(q);
+    for (int b = 0; b < 8; ++b) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + b * kStateSize), bs_transpose_bytes(q[b]));
+    }
+}
+
+PLUSAES_TARGET_SSE2
+inline void bs_load_key(const unsigned char key[16], __m128i q[8]) {
+    const __m128i k = bs_transpose_bytes(_mm_loadu_si128(reinterpret_cast<const __m128i *>(key)));
+    for (int i = 0; i < 8; ++i) {
+        const __m128i m = _mm_set1_epi8(static_cast<char>(1 << i));
+        q[i] = _mm_cmpeq_epi8(_mm_and_si128(k, m), m);
+    }
+}
+
+template<int N>
+PLUSAES_TARGET_SSE2
+inline __m128i bs_rotr_epi32(const __m128i x) {
+    return _mm_or_si128(_mm_srli_epi32(x, N), _mm_slli_epi32(x, 32 - N));
+}
+
+/** Takes the bits of b where m is set. */
+PLUSAES_TARGET_SSE2
+inline __m128i bs_blend(const __m128i a, const __m128i b, const __m128i m) {
+    return _mm_xor_si128(a, _mm_and_si128(_mm_xor_si128(a, b), m));
+}
+
+/** Row r is 32-bit lane r: rotates rows 2 and 3 by 16 bits, then rows 1 and 3 by 8 bits. */
+PLUSAES_TARGET_SSE2
+inline void bs_shift_rows(__m128i q[8]) {
+    const __m128i m23 = _mm_set_epi32(-1, -1, 0, 0);
+    const __m128i m13 = _mm_set_epi32(-1, 0, -1, 0);
+    for (int i = 0; i < 8; ++i) {
+        const __m128i x = bs_blend(q[i], bs_rotr_epi32<16>(q[i]), m23);
+        q[i] = bs_blend(x, bs_rotr_epi32<8>(x), m13);
+    }
+}
+
+PLUSAES_TARGET_SSE2
+inline void bs_inv_shift_rows(__m128i q[8]) {
+    const __m128i m23 = _mm_set_epi32(-1, -1, 0, 0);
+    const __m128i m13 = _mm_set_epi32(-1, 0, -1, 0);
+    for (int i = 0; i < 8; ++i) {
+        const __m128i x = bs_blend(q[i], bs_rotr_epi32<16>(q[i]), m23);
+        q[i] = bs_blend(x, bs_rotr_epi32<24>(x), m13);
+    }
+}
+
+PLUSAES_TARGET_SSE2
+inline void bs_rotate_rows1(const __m128i in[8], __m128i out[8]) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = _mm_shuffle_epi32(in[i], 0x39);
+    }
+}
+
+PLUSAES_TARGET_SSE2
+inline void bs_rotate_rows2(const __m128i in[8], __m128i out[8]) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = _mm_shuffle_epi32(in[i], 0x4E);
+    }
+}
+
+#if PLUSAES_HAS_AVX2
+
+template<int N>
+PLUSAES_TARGET_AVX2
+inline void bs_swap_move(__m256i &a, __m256i &b, const __m256i m) {
+    const __m256i t = _mm256_and_si256(_mm256_xor_si256(_mm256_srli_epi64(a, N), b), m);
+    b = _mm256_xor_si256(b, t);
+    a = _mm256_xor_si256(a, _mm256_slli_epi64(t, N));
+}
+
+PLUSAES_TARGET_AVX2
+inline void bs_ortho(__m256i q[8]) {
+    const __m256i m1 = _mm256_set1_epi8(0x55);
+    const __m256i m2 = _mm256_set1_epi8(0x33);
+    const __m256i m4 = _mm256_set1_epi8(0x0F);
+    for (int i = 0; i < 8; i += 2) {
+        bs_swap_move<1>(q[i], q[i + 1], m1);
+    }
+    for (int i = 0; i < 4; ++i) {
+        bs_swap_move<2>(q[i + (i & 2)], q[i + (i & 2) + 2], m2);
+    }
+    for (int i = 0; i < 4; ++i) {
+        bs_swap_move<4>(q[i], q[i + 4], m4);
+    }
+}
+
+/** Interleaves the bytes of blocks b and b + 8, so a state byte takes 16 bits after bs_ortho. */
+PLUSAES_TARGET_AVX2
+inline void bs_pack(const unsigned char *in, __m256i q[8]) {
+    for (int b = 0; b < 8; ++b) {
+        const __m128i lo = bs_transpose_bytes(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + b * kStateSize)));
+        const __m128i hi = bs_transpose_bytes(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + (b + 8) * kStateSize)));
+        q[b] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(lo, hi)), _mm_unpackhi_epi8(lo, hi), 1);
+    }
+    bs_ortho(q);
+}
+
+PLUSAES_TARGET_AVX2
+inline void bs_unpack(__m256i q[8], unsigned char *out) {
+    bs_ortho(q);
+    const __m128i m = _mm_set1_epi16(0x00FF);
+    for (int b = 0; b < 8; ++b) {
+        const __m128i x0 = _mm256_castsi256_si128(q[b]);
+        const __m128i x1 = _mm256_extracti128_si256(q[b], 1);
+        const __m128i lo = _mm_packus_epi16(_mm_and_si128(x0, m), _mm_and_si128(x1, m));
+        const __m128i hi = _mm_packus_epi16(_mm_srli_epi16(x0, 8), _mm_srli_epi16(x1, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + b * kStateSize), bs_transpose_bytes(lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + (b + 8) * kStateSize), bs_transpose_bytes(hi));
+    }
+}
+
+PLUSAES_TARGET_AVX2
+inline void bs_load_key(const unsigned char key[16], __m256i q[8]) {
+    const __m128i k = bs_transpose_bytes(_mm_loadu_si128(reinterpret_cast<const __m128i *>(key)));
+    const __m256i k2 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(k, k)), _mm_unpackhi_epi8(k, k), 1);
+    for (int i = 0; i < 8; ++i) {
+        const __m256i m = _mm256_set1_epi8(static_cast<char>(1 << i));
+        q[i] = _mm256_cmpeq_epi8(_mm256_and_si256(k2, m), m);
+    }
+}
+
+/** Row r is 64-bit lane r: rotates it by 16 * r bits. */
+PLUSAES_TARGET_AVX2
+inline void bs_shift_rows(__m256i q[8]) {
+    const __m256i r = _mm256_set_epi64x(48, 32, 16, 0);
+    const __m256i l = _mm256_set_epi64x(16, 32, 48, 64);
+    for (int i = 0; i < 8; ++i) {
+        q[i] = _mm256_or_si256(_mm256_srlv_epi64(q[i], r), _mm256_sllv_epi64(q[i], l));
+    }
+}
+
+PLUSAES_TARGET_AVX2
+inline void bs_inv_shift_rows(__m256i q[8]) {
+    const __m256i l = _mm256_set_epi64x(48, 32, 16, 0);
+    const __m256i r = _mm256_set_epi64x(16, 32, 48, 64);
+    for (int i = 0; i < 8; ++i) {
+        q[i] = _mm256_or_si256(_mm256_sllv_epi64(q[i], l), _mm256_srlv_epi64(q[i], r));
+    }
+}
+
+PLUSAES_TARGET_AVX2
+inline void bs_rotate_rows1(const __m256i in[8], __m256i out[8]) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = _mm256_permute4x64_epi64(in[i], 0x39);
+    }
+}
+
+PLUSAES_TARGET_AVX2
+inline void bs_rotate_rows2(const __m256i in[8], __m256i out[8]) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = _mm256_permute4x64_epi64(in[i], 0x4E);
+    }
+}
+
+#endif // PLUSAES_HAS_AVX2
+
+#endif // PLUSAES_HAS_AESNI
+
+// The generic rounds below only use ^, & and ~ on the slice words and the functions above.
+// They are force-inlined, so the SIMD ones end up in a caller compiled for SSE2 or AVX2.
+
+/** The forward S-box circuit (Boyar and Peralta). x0 is the most significant bit. */
+template<typename W>
+PLUSAES_FORCE_INLINE void bs_sbox(W q[8]) {
+    const W x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4];
+    const W x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+    // top linear transformation
+    const W y14 = x3 ^ x5;
+    const W y13 = x0 ^ x6;
+    const W y9 = x0 ^ x3;
+    const W y8 = x0 ^ x5;
+    const W t0 = x1 ^ x2;
+    const W y1 = t0 ^ x7;
+    const W y4 = y1 ^ x3;
+    const W y12 = y13 ^ y14;
+    const W y2 = y1 ^ x0;
+    const W y5 = y1 ^ x6;
+    const W y3 = y5 ^ y8;
+    const W t1 = x4 ^ y12;
+    const W y15 = t1 ^ x5;
+    const W y20 = t1 ^ x1;
+    const W y6 = y15 ^ x7;
+    const W y10 = y15 ^ t0;
+    const W y11 = y20 ^ y9;
+    const W y7 = x7 ^ y11;
+    const W y17 = y10 ^ y11;
+    const W y19 = y10 ^ y8;
+    const W y16 = t0 ^ y11;
+    const W y21 = y13 ^ y16;
+    const W y18 = x0 ^ y16;
+
+    // non-linear section
+    const W t2 = y12 & y15;
+    const W t3 = y3 & y6;
+    const W t4 = t3 ^ t2;
+    const W t5 = y4 & x7;
+    const W t6 = t5 ^ t2;
+    const W t7 = y13 & y16;
+    const W t8 = y5 & y1;
+    const W t9 = t8 ^ t7;
+    const W t10 = y2 & y7;
+    const W t11 = t10 ^ t7;
+    const W t12 = y9 & y11;
+    const W t13 = y14 & y17;
+    const W t14 = t13 ^ t12;
+    const W t15 = y8 & y10;
+    const W t16 = t15 ^ t12;
+    const W t17 = t4 ^ t14;
+    const W t18 = t6 ^ t16;
+    const W t19 = t9 ^ t14;
+    const W t20 = t11 ^ t16;
+    const W t21 = t17 ^ y20;
+    const W t22 = t18 ^ y19;
+    const W t23 = t19 ^ y21;
+    const W t24 = t20 ^ y18;
+
+    const W t25 = t21 ^ t22;
+    const W t26 = t21 & t23;
+    const W t27 = t24 ^ t26;
+    const W t28 = t25 & t27;
+    const W t29 = t28 ^ t22;
+    const W t30 = t23 ^ t24;
+    const W t31 = t22 ^ t26;
+    const W t32 = t31 & t30;
+    const W t33 = t32 ^ t24;
+    const W t34 = t23 ^ t33;
+    const W t35 = t27 ^ t33;
+    const W t36 = t24 & t35;
+    const W t37 = t36 ^ t34;
+    const W t38 = t27 ^ t36;
+    const W t39 = t29 & t38;
+    const W t40 = t25 ^ t39;
+
+    const W t41 = t40 ^ t37;
+    const W t42 = t29 ^ t33;
+    const W t43 = t29 ^ t40;
+    const W t44 = t33 ^ t37;
+    const W t45 = t42 ^ t41;
+    const W z0 = t44 & y15;
+    const W z1 = t37 & y6;
+    const W z2 = t33 & x7;
+    const W z3 = t43 & y16;
+    const W z4 = t40 & y1;
+    const W z5 = t29 & y7;
+    const W z6 = t42 & y11;
+    const W z7 = t45 & y17;
+    const W z8 = t41 & y10;
+    const W z9 = t44 & y12;
+    const W z10 = t37 & y3;
+    const W z11 = t33 & y4;
+    const W z12 = t43 & y13;
+    const W z13 = t40 & y5;
+    const W z14 = t29 & y2;
+    const W z15 = t42 & y9;
+    const W z16 = t45 & y14;
+    const W z17 = t41 & y8;
+
+    // bottom linear transformation
+    const W t46 = z15 ^ z16;
+    const W t47 = z10 ^ z11;
+    const W t48 = z5 ^ z13;
+    const W t49 = z9 ^ z10;
+    const W t50 = z2 ^ z12;
+    const W t51 = z2 ^ z5;
+    const W t52 = z7 ^ z8;
+    const W t53 = z0 ^ z3;
+    const W t54 = z6 ^ z7;
+    const W t55 = z16 ^ z17;
+    const W t56 = z12 ^ t48;
+    const W t57 = t50 ^ t53;
+    const W t58 = z4 ^ t46;
+    const W t59 = z3 ^ t54;
+    const W t60 = t46 ^ t57;
+    const W t61 = z14 ^ t57;
+    const W t62 = t52 ^ t58;
+    const W t63 = t49 ^ t58;
+    const W t64 = z4 ^ t59;
+    const W t65 = t61 ^ t62;
+    const W t66 = z1 ^ t63;
+    const W s0 = t59 ^ t63;
+    const W s6 = t56 ^ ~t62;
+    const W s7 = t48 ^ ~t60;
+    const W t67 = t64 ^ t65;
+    const W s3 = t53 ^ t66;
+    const W s4 = t51 ^ t66;
+    const W s5 = t47 ^ t65;
+    const W s1 = t64 ^ ~s3;
+    const W s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+/** q = A^-1 * (q ^ 0x63), where the S-box is S(x) = A * x^-1 ^ 0x63. */
+template<typename W>
+PLUSAES_FORCE_INLINE void bs_inv_affine(W q[8]) {
+    const W q0 = ~q[0], q1 = ~q[1], q2 = q[2], q3 = q[3];
+    const W q4 = q[4], q5 = ~q[5], q6 = ~q[6], q7 = q[7];
+    q[7] = q1 ^ q4 ^ q6;
+    q[6] = q0 ^ q3 ^ q5;
+    q[5] = q7 ^ q2 ^ q4;
+    q[4] = q6 ^ q1 ^ q3;
+    q[3] = q5 ^ q0 ^ q2;
+    q[2] = q4 ^ q7 ^ q1;
+    q[1] = q3 ^ q6 ^ q0;
+    q[0] = q2 ^ q5 ^ q7;
+}
+
+/** S^-1(x) = (A^-1 * (x ^ 0x63))^-1, and the inversion is A^-1 * (S(y) ^ 0x63). */
+template<typename W>
+PLUSAES_FORCE_INLINE void bs_inv_sbox(W q[8]) {
+    bs_inv_affine(q);
+    bs_sbox(q);
+    bs_inv_affine(q);
+}
+
+/** Multiplies every byte by x (0x02). */
+template<typename W>
+PLUSAES_FORCE_INLINE void bs_xtime(const W in[8], W out[8]) {
+    const W hi = in[7];
+    out[7] = in[6];
+    out[6] = in[5];
+    out[5] = in[4];
+    out[4] = in[3] ^ hi;
+    out[3] = in[2] ^ hi;
+    out[2] = in[1];
+    out[1] = in[0] ^ hi;
+    out[0] = hi;
+}
+
+/** out[r] = 2 * (a[r] ^ a[r+1]) ^ a[r+1] ^ (a[r+2] ^ a[r+3]), as mix_column_word. */
+template<typename W>
+PLUSAES_FORCE_INLINE void bs_mix_columns(W q[8]) {
+    W r[8], d[8], e[8];
+    bs_rotate_rows1(q, r);
+    for (int i = 0; i < 8; ++i) {
+        d[i] = q[i] ^ r[i];
+    }
+    bs_rotate_rows2(d, e);
+    bs_xtime(d, q);
+    for (int i = 0; i < 8; ++i) {
+        q[i] = q[i] ^ r[i] ^ e[i];
+    }
+}
+
+/** MixColumns after a[r] ^= 4 * (a[r] ^ a[r+2]), as inv_mix_columns. */
+template<typename W>
+PLUSAES_FORCE_INLINE void bs_inv_mix_columns(W q[8]) {
+    W t[8], u[8];
+    bs_rotate_rows2(q, t);
+    for (int i = 0; i < 8; ++i) {
+        t[i] = q[i] ^ t[i];
+    }
+    bs_xtime(t, u);
+    bs_xtime(u, t);
+    for (int i = 0; i < 8; ++i) {
+        q[i] = q[i] ^ t[i];
+    }
+    bs_mix_columns(q);
+}
+
+template<typename W>
+PLUSAES_FORCE_INLINE void bs_add_round_key(W q[8], const W k[8]) {
+    for (int i = 0; i < 8; ++i) {
+        q[i] = q[i] ^ k[i];
+    }
+}
+
+/** Converts the round keys to slice words, 8 per round. */
+template<typename W, int Nr>
+PLUSAES_FORCE_INLINE void bs_load_keys(const RoundKeys &rkeys, W skeys[(Nr + 1) * 8]) {
+    for (int i = 0; i <= Nr; ++i) {
+        unsigned char k[kStateSize];
+        memcpy(k, &rkeys[i], kStateSize);
+        bs_load_key(k, skeys + i * 8);
+    }
+}
+
+template<typename W, int Nr>
+PLUSAES_FORCE_INLINE void bs_encrypt(const W skeys[(Nr + 1) * 8], W q[8]) {
+    bs_add_round_key(q, skeys);
+    for (int i = 1; i < Nr; ++i) {
+        bs_sbox(q);
+        bs_shift_rows(q);
+        bs_mix_columns(q);
+        bs_add_round_key(q, skeys + i * 8);
+    }
+    bs_sbox(q);
+    bs_shift_rows(q);
+    bs_add_round_key(q, skeys + Nr * 8);
+}
+
+/** Equivalent inverse cipher (FIPS-197 5.3.5) with the decryption round keys. */
+template<typename W, int Nr>
+PLUSAES_FORCE_INLINE void bs_decrypt(const W skeys[(Nr + 1) * 8], W q[8]) {
+    bs_add_round_key(q, skeys + Nr * 8);
+    for (int i = Nr - 1; i > 0; --i) {
+        bs_inv_sbox(q);
+        bs_inv_shift_rows(q);
+        bs_inv_mix_columns(q);
+        bs_add_round_key(q, skeys + i * 8);
+    }
+    bs_inv_sbox(q);
+    bs_inv_shift_rows(q);
+    bs_add_round_key(q, skeys);
+}
+
+/** Processes the blocks a group of slice words at a time; the last group is padded with zero blocks. */
+template<typename W, int Nr, bool Encrypts>
+PLUSAES_FORCE_INLINE void bs_crypt_blocks_nr(const RoundKeys &keys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    const std::size_t n = sizeof(W) * 8 / kStateSize; // a bit of each state byte of n blocks
+    W skeys[(Nr + 1) * 8];
+    bs_load_keys<W, Nr>(keys, skeys);
+
+    W q[8];
+    for (; nblocks >= n; nblocks -= n) {
+        bs_pack(in, q);
+        if (Encrypts) bs_encrypt<W, Nr>(skeys, q);
+        else bs_decrypt<W, Nr>(skeys, q);
+        bs_unpack(q, out);
+        in += n * kStateSize;
+        out += n * kStateSize;
+    }
+
+    if (nblocks > 0) {
+        unsigned char buf[n * kStateSize] = {};
+        memcpy(buf, in, nblocks * kStateSize);
+        bs_pack(buf, q);
+        if (Encrypts) bs_encrypt<W, Nr>(skeys, q);
+        else bs_decrypt<W, Nr>(skeys, q);
+        bs_unpack(q, buf);
+        memcpy(out, buf, nblocks * kStateSize);
+    }
+}
+
+template<typename W, bool Encrypts>
+PLUSAES_FORCE_INLINE void bs_crypt_blocks(const RoundKeys &keys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    switch (get_rounds(keys)) {
+    case 10: bs_crypt_blocks_nr<W, 10, Encrypts>(keys, in, out, nblocks); break;
+    case 12: bs_crypt_blocks_nr<W, 12, Encrypts>(keys, in, out, nblocks); break;
+    default: bs_crypt_blocks_nr<W, 14, Encrypts>(keys, in, out, nblocks); break;
+    }
+}
+
+inline void bs_encrypt_blocks_u64(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    bs_crypt_blocks<uint64_t, true>(rkeys, in, out, nblocks);
+}
+
+inline void bs_decrypt_blocks_u64(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    bs_crypt_blocks<uint64_t, false>(dkeys, in, out, nblocks);
+}
+
+#if PLUSAES_HAS_AESNI
+PLUSAES_TARGET_SSE2
+inline void bs_encrypt_blocks_sse2(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    bs_crypt_blocks<__m128i, true>(rkeys, in, out, nblocks);
+}
+
+PLUSAES_TARGET_SSE2
+inline void bs_decrypt_blocks_sse2(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    bs_crypt_blocks<__m128i, false>(dkeys, in, out, nblocks);
+}
+#endif
+
+#if PLUSAES_HAS_AVX2
+PLUSAES_TARGET_AVX2
+inline void bs_encrypt_blocks_avx2(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    bs_crypt_blocks<__m256i, true>(rkeys, in, out, nblocks);
+}
+
+PLUSAES_TARGET_AVX2
+inline void bs_decrypt_blocks_avx2(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    bs_crypt_blocks<__m256i, false>(dkeys, in, out, nblocks);
+}
+#endif
+
+/** Takes the widest slice words the CPU has for the whole groups, and uint64_t for the rest. */
+inline void bs_crypt_blocks(const RoundKeys &keys, const unsigned char *in, unsigned char *out, std::size_t nblocks, const bool encrypts) {
+#if PLUSAES_HAS_AVX2
+    const std::size_t avx2_blocks = sizeof(__m256i) * 8 / kStateSize;
+    if (nblocks >= avx2_blocks && has_avx2()) {
+        const std::size_t n = nblocks - nblocks % avx2_blocks;
+        if (encrypts) bs_encrypt_blocks_avx2(keys, in, out, n);
+        else bs_decrypt_blocks_avx2(keys, in, out, n);
+        in += n * kStateSize;
+        out += n * kStateSize;
+        nblocks -= n;
+    }
+#endif
+#if PLUSAES_HAS_AESNI
+    const std::size_t sse2_blocks = sizeof(__m128i) * 8 / kStateSize;
+    if (nblocks >= sse2_blocks && has_sse2()) {
+        const std::size_t n = nblocks - nblocks % sse2_blocks;
+        if (encrypts) bs_encrypt_blocks_sse2(keys, in, out, n);
+        else bs_decrypt_blocks_sse2(keys, in, out, n);
+        in += n * kStateSize;
+        out += n * kStateSize;
+        nblocks -= n;
+    }
+#endif
+    if (nblocks > 0) {
+        if (encrypts) bs_encrypt_blocks_u64(keys, in, out, nblocks);
+        else bs_decrypt_blocks_u64(keys, in, out, nblocks);
+    }
+}
+
+/** SubWord by the S-box circuit: bit i of byte j is bit j of q[i]. */
+inline Word bs_sub_word(const Word w) {
+    uint64_t q[8];
+    for (int i = 0; i < 8; ++i) {
+        q[i] = 0;
+        for (int j = 0; j < 4; ++j) {
+            q[i] |= static_cast<uint64_t>((w >> (j * 8 + i)) & 1) << j;
+        }
+    }
+    bs_sbox(q);
+
+    Word r = 0;
+    for (int i = 0; i < 8; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            r |= static_cast<Word>((q[i] >> j) & 1) << (j * 8 + i);
+        }
+    }
+    return r;
+}
+
+#if PLUSAES_HAS_AESNI
+
+// Vector permute rounds (SSSE3)
+//
+// One block at a time without data-dependent memory accesses: a byte is split
+// into two GF(16) coordinates (its nibbles), and the S-box inversion is done
+// with 16-entry tables in registers by pshufb (M. Hamburg, "Accelerating AES
+// with Vector Permute Instructions", CHES 2009). The state stays in these
+// coordinates between rounds, and the round keys are converted on the fly.
+
+// generated by scripts/gen-vperm-tables.py (V = 0x12, A = 0xD)
+// GF(16) inverse (1/0 = 0x80)
+const unsigned char kVpInv[16] = {
+    0x80, 0x01, 0x08, 0x0D, 0x0F, 0x06, 0x05, 0x0E, 0x02, 0x0C, 0x0B, 0x0A, 0x09, 0x03, 0x07, 0x04,
+};
+// A / k (A / 0 = 0x80)
+const unsigned char kVpADiv[16] = {
+    0x80, 0x0D, 0x05, 0x06, 0x0A, 0x02, 0x03, 0x07, 0x0C, 0x0B, 0x04, 0x09, 0x08, 0x01, 0x0F, 0x0E,
+};
+// byte -> tower coordinates, by low and high nibble
+const unsigned char kVpIpt[2][16] = {
+    {0x00, 0x10, 0x36, 0x26, 0x7C, 0x6C, 0x4A, 0x5A, 0x5C, 0x4C, 0x6A, 0x7A, 0x20, 0x30, 0x16, 0x06},
+    {0x00, 0x37, 0xA9, 0x9E, 0x77, 0x40, 0xDE, 0xE9, 0x1E, 0x29, 0xB7, 0x80, 0x69, 0x5E, 0xC0, 0xF7},
+};
+// encryption: tower(affine(x^-1)) by io and jo
+const unsigned char kVpSb1[2][16] = {
+    {0x00, 0x3C, 0xDA, 0x10, 0xC1, 0x27, 0xCA, 0xFD, 0xD1, 0x2C, 0x37, 0x0B, 0xE6, 0xED, 0x1B, 0xF6},
+    {0x00, 0x0D, 0xC3, 0xEC, 0x5F, 0x91, 0x2F, 0x52, 0xB3, 0xE1, 0x7D, 0x70, 0xCE, 0xBE, 0x9C, 0x22},
+};
+// encryption: tower(2 * affine(x^-1))
+const unsigned char kVpSb2[2][16] = {
+    {0x00, 0xEB, 0x85, 0x36, 0xF1, 0x9F, 0xB3, 0x1A, 0xC7, 0xDD, 0xA9, 0x42, 0x6E, 0x2C, 0x74, 0x58},
+    {0x00, 0x63, 0x3C, 0xF9, 0x2F, 0x70, 0xC5, 0x4C, 0xD6, 0x9A, 0x89, 0xEA, 0x5F, 0xB5, 0x13, 0xA6},
+};
+// last encryption round: affine(x^-1)
+const unsigned char kVpSbo[2][16] = {
+    {0x00, 0x54, 0xB7, 0x01, 0xF2, 0x11, 0xB6, 0xA6, 0xF3, 0x55, 0x10, 0x44, 0xE3, 0xA7, 0x45, 0xE2},
+    {0x00, 0x4B, 0x2A, 0xB5, 0xC2, 0xA3, 0x9F, 0x89, 0x77, 0xFE, 0x16, 0x5D, 0x61, 0x3C, 0xE8, 0xD4},
+};
+// byte -> decryption coordinates (tower of A^-1 * x)
+const unsigned char kVpDipt[2][16] = {
+    {0x00, 0x1D, 0x55, 0x48, 0xE5, 0xF8, 0xB0, 0xAD, 0x76, 0x6B, 0x23, 0x3E, 0x93, 0x8E, 0xC6, 0xDB},
+    {0x00, 0xCB, 0x3B, 0xF0, 0x1F, 0xD4, 0x24, 0xEF, 0xC5, 0x0E, 0xFE, 0x35, 0xDA, 0x11, 0xE1, 0x2A},
+};
+// decryption: tower(A^-1 * 9 * x^-1)
+const unsigned char kVpDsb9[2][16] = {
+    {0x00, 0x4C, 0x82, 0xA8, 0x04, 0xCA, 0x2A, 0x48, 0xAC, 0xE4, 0x62, 0x2E, 0xCE, 0xE0, 0x86, 0x66},
+    {0x00, 0x27, 0x30, 0x20, 0x3B, 0x2C, 0x10, 0x1C, 0x1B, 0x07, 0x0C, 0x2B, 0x17, 0x3C, 0x0B, 0x37},
+};
+// decryption: tower(A^-1 * 11 * x^-1)
+const unsigned char kVpDsbB[2][16] = {
+    {0x00, 0x7A, 0xAB, 0x43, 0x6C, 0xBD, 0xE8, 0x16, 0x2F, 0x39, 0xFE, 0x84, 0xD1, 0x55, 0xC7, 0x92},
+    {0x00, 0x44, 0xC8, 0xB1, 0x94, 0x18, 0x79, 0xD0, 0x25, 0xF5, 0xA9, 0xED, 0x8C, 0x61, 0x5C, 0x3D},
+};
+// decryption: tower(A^-1 * 13 * x^-1)
+const unsigned char kVpDsbD[2][16] = {
+    {0x00, 0x30, 0x3B, 0x10, 0x37, 0x3C, 0x2B, 0x07, 0x27, 0x20, 0x2C, 0x1C, 0x0B, 0x17, 0x0C, 0x1B},
+    {0x00, 0xBE, 0x13, 0x0D, 0x6D, 0xC0, 0x1E, 0xD3, 0x60, 0xB3, 0xCD, 0x73, 0xAD, 0xDE, 0x7E, 0xA0},
+};
+// decryption: tower(A^-1 * 14 * x^-1)
+const unsigned char kVpDsbE[2][16] = {
+    {0x00, 0x16, 0x39, 0xC7, 0x43, 0x6C, 0xFE, 0x55, 0x84, 0xD1, 0xAB, 0xBD, 0x2F, 0x92, 0x7A, 0xE8},
+    {0x00, 0xD0, 0xF5, 0x5C, 0xB1, 0x94, 0xA9, 0x61, 0xED, 0x8C, 0xC8, 0x18, 0x25, 0x3D, 0x44, 0x79},
+};
+// last decryption round: x^-1
+const unsigned char kVpDsbo[2][16] = {
+    {0x00, 0x1F, 0x3F, 0x4A, 0xCE, 0xEE, 0x75, 0xD1, 0x84, 0x55, 0xA4, 0xBB, 0x20, 0x9B, 0xF1, 0x6A},
+    {0x00, 0x1E, 0x8F, 0xAB, 0x23, 0xB2, 0x24, 0x3D, 0x88, 0xB5, 0x19, 0x07, 0x91, 0x96, 0xAC, 0x3A},
+};
+
+// pshufb masks on the column-major state, byte (col * 4 + row):
+// [k] is (Inv)ShiftRows followed by moving row r + k to row r, for (Inv)MixColumns.
+const unsigned char kVpShiftRows[4][16] = {
+    {0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11},
+    {5, 10, 15, 0, 9, 14, 3, 4, 13, 2, 7, 8, 1, 6, 11, 12},
+    {10, 15, 0, 5, 14, 3, 4, 9, 2, 7, 8, 13, 6, 11, 12, 1},
+    {15, 0, 5, 10, 3, 4, 9, 14, 7, 8, 13, 2, 11, 12, 1, 6},
+};
+const unsigned char kVpInvShiftRows[4][16] = {
+    {0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3},
+    {13, 10, 7, 0, 1, 14, 11, 4, 5, 2, 15, 8, 9, 6, 3, 12},
+    {10, 7, 0, 13, 14, 11, 4, 1, 2, 15, 8, 5, 6, 3, 12, 9},
+    {7, 0, 13, 10, 11, 4, 1, 14, 15, 8, 5, 2, 3, 12, 9, 6},
+};
+
+PLUSAES_TARGET_SSSE3
+inline __m128i vp_load(const void *p) {
+    return _mm_loadu_si128(static_cast<const __m128i *>(p));
+}
+
+/** t[0][low nibble] ^ t[1][high nibble] of each byte. */
+PLUSAES_TARGET_SSSE3
+inline __m128i vp_transform(const unsigned char t[2][16], const __m128i x) {
+    const __m128i m = _mm_set1_epi8(0x0F);
+    const __m128i lo = _mm_and_si128(x, m);
+    const __m128i hi = _mm_and_si128(_mm_srli_epi32(x, 4), m);
+    return _mm_xor_si128(_mm_shuffle_epi8(vp_load(t[0]), lo), _mm_shuffle_epi8(vp_load(t[1]), hi));
+}
+
+/** Inverts the bytes in tower coordinates. The output table t of a round gives t[0][io] ^ t[1][jo]. */
+PLUSAES_TARGET_SSSE3
+inline void vp_invert(const __m128i x, __m128i &io, __m128i &jo) {
+    const __m128i m = _mm_set1_epi8(0x0F);
+    const __m128i inv = vp_load(kVpInv);
+    const __m128i k = _mm_and_si128(x, m);
+    const __m128i i = _mm_and_si128(_mm_srli_epi32(x, 4), m);
+    const __m128i j = _mm_xor_si128(i, k);
+    const __m128i ak = _mm_shuffle_epi8(vp_load(kVpADiv), k);
+    io = _mm_xor_si128(j, _mm_shuffle_epi8(inv, _mm_xor_si128(_mm_shuffle_epi8(inv, i), ak)));
+    jo = _mm_xor_si128(i, _mm_shuffle_epi8(inv, _mm_xor_si128(_mm_shuffle_epi8(inv, j), ak)));
+}
+
+PLUSAES_TARGET_SSSE3
+inline __m128i vp_lookup(const unsigned char t[2][16], const __m128i io, const __m128i jo) {
+    return _mm_xor_si128(_mm_shuffle_epi8(vp_load(t[0]), io), _mm_shuffle_epi8(vp_load(t[1]), jo));
+}
+
+/**
+ * SubBytes comes first, so (Inv)ShiftRows and the row moves of (Inv)MixColumns are one pshufb per term
+ * and a round has a short dependency chain. The S-box constant 0x63 is left out of the tables
+ * and added to the round keys instead (MixColumns maps 0x63 in every byte to itself).
+ */
+template<int Nr>
+PLUSAES_TARGET_SSSE3
+inline void vp_encrypt_state_nr(const RoundKeys &rkeys, const unsigned char data[16], unsigned char encrypted[16]) {
+    const __m128i c63 = _mm_set1_epi8(0x63);
+    const __m128i sr0 = vp_load(kVpShiftRows[0]);
+    const __m128i sr1 = vp_load(kVpShiftRows[1]);
+    const __m128i sr2 = vp_load(kVpShiftRows[2]);
+    const __m128i sr3 = vp_load(kVpShiftRows[3]);
+    __m128i io, jo;
+
+    __m128i s = vp_transform(kVpIpt, _mm_xor_si128(vp_load(data), vp_load(&rkeys[0])));
+    for (int r = 1; r < Nr; ++r) {
+        vp_invert(s, io, jo);
+        const __m128i a = vp_lookup(kVpSb1, io, jo);
+        const __m128i a2 = vp_lookup(kVpSb2, io, jo);
+        // 2 * a[r] ^ 3 * a[r + 1] ^ a[r + 2] ^ a[r + 3]
+        const __m128i t0 = _mm_xor_si128(_mm_shuffle_epi8(a2, sr0), _mm_shuffle_epi8(a2, sr1));
+        const __m128i t1 = _mm_xor_si128(_mm_shuffle_epi8(a, sr1), _mm_shuffle_epi8(a, sr2));
+        const __m128i t2 = _mm_xor_si128(_mm_shuffle_epi8(a, sr3),
+                                         vp_transform(kVpIpt, _mm_xor_si128(vp_load(&rkeys[r]), c63)));
+        s = _mm_xor_si128(_mm_xor_si128(t0, t1), t2);
+    }
+    vp_invert(s, io, jo);
+    s = _mm_shuffle_epi8(vp_lookup(kVpSbo, io, jo), sr0);
+    s = _mm_xor_si128(s, _mm_xor_si128(vp_load(&rkeys[Nr]), c63));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(encrypted), s);
+}
+
+PLUSAES_TARGET_SSSE3
+inline void vp_encrypt_state(const RoundKeys &rkeys, const unsigned char data[16], unsigned char encrypted[16]) {
+    switch (get_rounds(rkeys)) {
+    case 10: vp_encrypt_state_nr<10>(rkeys, data, encrypted); break;
+    case 12: vp_encrypt_state_nr<12>(rkeys, data, encrypted); break;
+    default: vp_encrypt_state_nr<14>(rkeys, data, encrypted); break;
+    }
+}
+
+/**
+ * The equivalent inverse cipher, so it takes the decryption round keys.
+ * The state is in the tower coordinates of A^-1 * x, where A is the linear part of the S-box affine map.
+ */
+template<int Nr>
+PLUSAES_TARGET_SSSE3
+inline void vp_decrypt_state_nr(const RoundKeys &dkeys, const unsigned char data[16], unsigned char decrypted[16]) {
+    const __m128i c63 = _mm_set1_epi8(0x63);
+    const __m128i isr0 = vp_load(kVpInvShiftRows[0]);
+    const __m128i isr1 = vp_load(kVpInvShiftRows[1]);
+    const __m128i isr2 = vp_load(kVpInvShiftRows[2]);
+    const __m128i isr3 = vp_load(kVpInvShiftRows[3]);
+    __m128i io, jo;
+
+    __m128i s = vp_transform(kVpDipt, _mm_xor_si128(vp_load(data), _mm_xor_si128(vp_load(&dkeys[Nr]), c63)));
+    for (int r = Nr - 1; r > 0; --r) {
+        vp_invert(s, io, jo);
+        // 14 * b[r] ^ 11 * b[r + 1] ^ 13 * b[r + 2] ^ 9 * b[r + 3]
+        const __m128i t0 = _mm_xor_si128(_mm_shuffle_epi8(vp_lookup(kVpDsbE, io, jo), isr0),
+                                         _mm_shuffle_epi8(vp_lookup(kVpDsbB, io, jo), isr1));
+        const __m128i t1 = _mm_xor_si128(_mm_shuffle_epi8(vp_lookup(kVpDsbD, io, jo), isr2),
+                                         _mm_shuffle_epi8(vp_lookup(kVpDsb9, io, jo), isr3));
+        s = _mm_xor_si128(_mm_xor_si128(t0, t1),
+                          vp_transform(kVpDipt, _mm_xor_si128(vp_load(&dkeys[r]), c63)));
+    }
+    vp_invert(s, io, jo);
+    s = _mm_shuffle_epi8(vp_lookup(kVpDsbo, io, jo), isr0);
+    s = _mm_xor_si128(s, vp_load(&dkeys[0]));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(decrypted), s);
+}
+
+PLUSAES_TARGET_SSSE3
+inline void vp_decrypt_state(const RoundKeys &dkeys, const unsigned char data[16], unsigned char decrypted[16]) {
+    switch (get_rounds(dkeys)) {
+    case 10: vp_decrypt_state_nr<10>(dkeys, data, decrypted); break;
+    case 12: vp_decrypt_state_nr<12>(dkeys, data, decrypted); break;
+    default: vp_decrypt_state_nr<14>(dkeys, data, decrypted); break;
+    }
+}
+
+/** SubWord by the vector permute S-box, for the key expansion. */
+PLUSAES_TARGET_SSSE3
+inline Word vp_sub_word(const Word w) {
+    __m128i io, jo;
+    vp_invert(vp_transform(kVpIpt, _mm_cvtsi32_si128(static_cast<int>(w))), io, jo);
+    return static_cast<Word>(_mm_cvtsi128_si32(vp_lookup(kVpSbo, io, jo))) ^ 0x63636363;
+}
+
+#endif // PLUSAES_HAS_AESNI
+
+inline bool uses_constant_time_rounds();
+
+/**
+ * SubWord of the key expansion. Without table lookups with PLUSAES_USE_BITSLICE
+ * or when the active backend is constant-time, so that the schedule does not leak the key either.
+ */
+inline Word key_sub_word(const Word w) {
+#if PLUSAES_USE_BITSLICE
+    return bs_sub_word(w);
+#else
+    if (uses_constant_time_rounds()) {
+#if PLUSAES_HAS_AESNI
+        if (has_ssse3()) {
+            return vp_sub_word(w);
+        }
+#endif
+        return bs_sub_word(w);
+    }
+    return sub_word(w);
+#endif
+}
+
+/**
+ * @private
+ * @throws std::invalid_argument
+ *  With PLUSAES_NO_EXCEPTIONS, returns an empty schedule (0 rounds) instead.
+ */
+inline RoundKeys expand_key(const unsigned char *key, const int key_size) {
+    if (key_size != 16 && key_size != 24 && key_size != 32) {
+#if PLUSAES_NO_EXCEPTIONS
+        return RoundKeys();
+#else
+        throw std::invalid_argument("Invalid key size");
+#endif
+    }
+
+    const Word rcon[] = {
+        0x00, 0x01, 0x02, 0x04, 0x08, 0x10,
+        0x20, 0x40, 0x80, 0x1b, 0x36
+    };
+
+    const int nb = kBlockSize;
+    const int nk = key_size / nb;
+    const int nr = get_round_count(key_size);
+
+    RoundKeys keys;
+    keys.rounds = nr;
+
+#if PLUSAES_HAS_AESNI
+    if (has_aesni()) {
+        aesni_expand_key(key, key_size, keys);
+        return keys;
+    }
+#endif
+
+    // word i of the schedule is keys[i / nb][i % nb]
+    for (int i = 0; i < nk; ++ i) {
+        memcpy(&keys[i / nb][i % nb], key + (i * kWordSize), kWordSize);
+    }
+
+    for (int i = nk; i < nb * (nr + 1); ++i) {
+        Word t = keys[(i - 1) / nb][(i - 1) % nb];
+        if (i % nk == 0) {
+            t = key_sub_word(rot_word(t)) ^ rcon[i / nk];
+        }
+        else if (nk > 6 && i % nk == 4) {
+            t = key_sub_word(t);
+        }
+
+        keys[i / nb][i % nb] = t ^ keys[(i - nk) / nb][(i - nk) % nb];
+    }
+
+    return keys;
+}
+
+inline void copy_bytes_to_state(const unsigned char data[16], State &state) {
+    memcpy(&state[0], data +  0, kWordSize);
+    memcpy(&state[1], data +  4, kWordSize);
+    memcpy(&state[2], data +  8, kWordSize);
+    memcpy(&state[3], data + 12, kWordSize);
+}
+
+inline void copy_state_to_bytes(const State &state, unsigned char buf[16]) {
+    memcpy(buf +  0, &state[0], kWordSize);
+    memcpy(buf +  4, &state[1], kWordSize);
+    memcpy(buf +  8, &state[2], kWordSize);
+    memcpy(buf + 12, &state[3], kWordSize);
+}
+
+/** data ^= v by machine words. The buffers may be unaligned. */
+inline void xor_bytes(unsigned char *data, const unsigned char *v, const std::size_t size) {
+    const std::size_t ws = sizeof(std::size_t);
+
+    std::size_t i = 0;
+    for (; i + ws <= size; i += ws) {
+        std::size_t a, b;
+        memcpy(&a, data + i, ws);
+        memcpy(&b, v + i, ws);
+        a ^= b;
+        memcpy(data + i, &a, ws);
+    }
+    for (; i < size; ++i) {
+        data[i] ^= v[i];
+    }
+}
+
+/**
+ * data ^= v for a block. The copies let the compiler use one 16 bytes store even if data
+ * and v may overlap, so that the next round can load the block without a store forwarding stall.
+ */
+inline void xor_data(unsigned char data[kStateSize], const unsigned char v[kStateSize]) {
+    unsigned char a[kStateSize], b[kStateSize];
+    memcpy(a, data, kStateSize);
+    memcpy(b, v, kStateSize);
+    for (int i = 0; i < kStateSize; ++i) {
+        a[i] ^= b[i];
+    }
+    memcpy(data, a, kStateSize);
+}
+
+/** Number of blocks CBC decryption decrypts before chaining them (1 KiB). */
+const unsigned long kCbcBatchBlocks = 64;
+
+/** Number of counter blocks CTR mode encrypts at once (one AVX2 group of the bitsliced rounds). */
+#if PLUSAES_USE_BITSLICE
+const unsigned long kCtrBatchBlocks = 16;
+#else
+const unsigned long kCtrBatchBlocks = 8;
+#endif
+
+/** increment counter (128-bit int) by 1 */
+inline void incr_counter(unsigned char counter[kStateSize]) {
+    unsigned n = kStateSize, c = 1;
+    do {
+        --n;
+        c += counter[n];
+        counter[n] = c;
+        c >>= 8;
+    } while (n);
+}
+
+inline uint64_t load_be64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+inline void store_be64(unsigned char *p, uint64_t v) {
+    for (int i = 7; i >= 0; --i) {
+        p[i] = static_cast<unsigned char>(v);
+        v >>= 8;
+    }
+}
+
+/** 128-bit big-endian counter held as two 64-bit halves */
+typedef struct {
+    uint64_t hi;
+    uint64_t lo;
+} Counter;
+
+inline Counter load_counter(const unsigned char counter[kStateSize]) {
+    const Counter c = { load_be64(counter), load_be64(counter + 8) };
+    return c;
+}
+
+/** Writes n successive counter blocks and advances the counter by n. */
+inline void make_counter_blocks(Counter &c, unsigned char *blocks, const unsigned long n) {
+    for (unsigned long i = 0; i < n; ++i) {
+        store_be64(blocks + i * kStateSize, c.hi);
+        store_be64(blocks + i * kStateSize + 8, c.lo);
+        c.lo += 1;
+        c.hi += (c.lo == 0) ? 1 : 0;
+    }
+}
+
+/** Advances the counter by n blocks. */
+inline void add_counter(Counter &c, const uint64_t n) {
+    c.lo += n;
+    c.hi += (c.lo < n) ? 1 : 0;
+}
+
+#if PLUSAES_HAS_VAES
+
+/** Counter blocks ctr + first and ctr + first + 1 of base (vaes_counter_base) in big-endian bytes. */
+PLUSAES_TARGET_VAES_AVX2
+inline __m256i vaes_counter2(const __m256i &base, const int first) {
+    const __m256i bswap = _mm256_set_epi8(
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    return _mm256_shuffle_epi8(_mm256_add_epi64(base, _mm256_set_epi64x(0, first, 0, first)), bswap);
+}
+
+/** ctr and ctr + 1 as little-endian lanes, advanced only in the low 64 bits. */
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_counter_base(const Counter &c, __m256i &base) {
+    const __m128i ctr = _mm_set_epi64x(static_cast<int64_t>(c.hi), static_cast<int64_t>(c.lo));
+    base = _mm256_add_epi64(_mm256_broadcastsi128_si256(ctr), _mm256_set_epi64x(0, 1, 0, 0));
+}
+
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_advance_counter(__m256i &base, const int n) {
+    base = _mm256_add_epi64(base, _mm256_set_epi64x(0, n, 0, n));
+}
+
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_counters(const __m256i &base, const int first, __m256i &v) {
+    v = vaes_counter2(base, first);
+}
+
+PLUSAES_TARGET_VAES_AVX512
+inline void vaes_counters(const __m256i &base, const int first, __m512i &v) {
+    v = _mm512_maskz_inserti64x4(0xFF, _mm512_setzero_si512(), vaes_counter2(base, first), 0);
+    v = _mm512_maskz_inserti64x4(0xFF, v, vaes_counter2(base, first + 2), 1);
+}
+
+/** XORs the keystream of nblocks whole blocks from counter c into data. */
+template<typename V, int Nr>
+PLUSAES_FORCE_INLINE void vaes_crypt_ctr_nr(const RoundKeys &rkeys, const Counter &c, unsigned char *data, std::size_t nblocks) {
+    const int lane_blocks = sizeof(V) / kStateSize;
+    const int group_blocks = kAesniParallelBlocks * lane_blocks;
+
+    V k[Nr + 1];
+    for (int i = 0; i <= Nr; ++i) {
+        vaes_broadcast(rkeys[i], k[i]);
+    }
+
+    __m256i base;
+    vaes_counter_base(c, base);
+
+    for (; nblocks >= static_cast<std::size_t>(group_blocks); nblocks -= group_blocks) {
+        V b[kAesniParallelBlocks];
+        for (int j = 0; j < kAesniParallelBlocks; ++j) {
+            vaes_counters(base, j * lane_blocks, b[j]);
+            vaes_xor(b[j], k[0]);
+        }
+        for (int i = 1; i < Nr; ++i) {
+            vaes_round8<V, true, false>(b, k[i]);
+        }
+        vaes_round8<V, true, true>(b, k[Nr]);
+        for (int j = 0; j < kAesniParallelBlocks; ++j) {
+            V d;
+            vaes_load(data + j * sizeof(V), d);
+            vaes_xor(d, b[j]);
+            vaes_store(data + j * sizeof(V), d);
+        }
+        vaes_advance_counter(base, group_blocks);
+        data += group_blocks * kStateSize;
+    }
+
+    for (int first = 0; nblocks > 0; first += lane_blocks) {
+        const std::size_t n = (nblocks < static_cast<std::size_t>(lane_blocks)) ? nblocks : lane_blocks;
+        V b, d;
+        vaes_counters(base, first, b);
+        vaes_crypt<V, Nr, true>(b, k);
+
+        unsigned char buf[sizeof(V)] = {};
+        memcpy(buf, data, n * kStateSize);
+        vaes_load(buf, d);
+        vaes_xor(d, b);
+        vaes_store(buf, d);
+        memcpy(data, buf, n * kStateSize);
+        data += n * kStateSize;
+        nblocks -= n;
+    }
+}
+
+template<typename V>
+PLUSAES_FORCE_INLINE void vaes_crypt_ctr(const RoundKeys &rkeys, const Counter &c, unsigned char *data, std::size_t nblocks) {
+    switch (get_rounds(rkeys)) {
+    case 10: vaes_crypt_ctr_nr<V, 10>(rkeys, c, data, nblocks); break;
+    case 12: vaes_crypt_ctr_nr<V, 12>(rkeys, c, data, nblocks); break;
+    default: vaes_crypt_ctr_nr<V, 14>(rkeys, c, data, nblocks); break;
+    }
+}
+
+PLUSAES_TARGET_VAES_AVX2
+inline void vaes_avx2_crypt_ctr(const RoundKeys &rkeys, const Counter &c, unsigned char *data, std::size_t nblocks) {
+    vaes_crypt_ctr<__m256i>(rkeys, c, data, nblocks);
+}
+
+PLUSAES_TARGET_VAES_AVX512
+inline void vaes_avx512_crypt_ctr(const RoundKeys &rkeys, const Counter &c, unsigned char *data, std::size_t nblocks) {
+    vaes_crypt_ctr<__m512i>(rkeys, c, data, nblocks);
+}
+
+/**
+ * Encrypts or decrypts the whole blocks of data in-place with CTR mode, with the counter blocks
+ * built in registers. It stops where the low 64 bits of the counter would wrap.
+ * @return Processed size in bytes. 0 if the CPU has no VAES.
+ */
+inline unsigned long vaes_crypt_ctr(const RoundKeys &rkeys, Counter &c, unsigned char *data, const unsigned long data_size) {
+    std::size_t nblocks = data_size / kStateSize;
+    const uint64_t until_wrap = 0 - c.lo;
+    if (c.lo != 0 && nblocks > until_wrap) {
+        nblocks = static_cast<std::size_t>(until_wrap);
+    }
+
+    if (nblocks >= sizeof(__m512i) / kStateSize && has_vaes_avx512()) {
+        vaes_avx512_crypt_ctr(rkeys, c, data, nblocks);
+    }
+    else if (nblocks >= sizeof(__m256i) / kStateSize && has_vaes_avx2()) {
+        vaes_avx2_crypt_ctr(rkeys, c, data, nblocks);
+    }
+    else {
+        return 0;
+    }
+    add_counter(c, nblocks);
+    return static_cast<unsigned long>(nblocks * kStateSize);
+}
+
+#endif // PLUSAES_HAS_VAES
+
+/** Number of bytes of a GCM block (same as the AES block). */
+const unsigned long kGcmBlockSize = 16;
+
+/**
+ * GHASH multiplication table for a hash key H (Shoup's 4-bit method).
+ * hh[i]:hl[i] is H multiplied by the 4-bit value i.
+ */
+typedef struct {
+    uint64_t hh[16];
+    uint64_t hl[16];
+#if PLUSAES_HAS_AESNI
+    /** H^1..H^8 byte-reversed, for the PCLMULQDQ path. Set only when has_pclmul(). */
+    unsigned char hpow[8][16];
+#endif
+} GcmTable;
+
+/** Reduction constants for the 4 bits shifted out per step. */
+const uint64_t kGcmLast4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+#if PLUSAES_HAS_AESNI
+
+/** Number of blocks GHASH with PCLMULQDQ multiplies before one reduction. */
+const int kPclmulGhashBlocks = 8;
+
+/** Reverses the bytes, so a GCM block becomes a polynomial in the register. */
+PLUSAES_TARGET_PCLMUL
+inline __m128i pclmul_bswap(const __m128i v) {
+    return _mm_shuffle_epi8(v, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+/** Accumulates the 256-bit product a * b without reduction (lo, hi and the middle terms). */
+PLUSAES_TARGET_PCLMUL
+inline void pclmul_mul_acc(const __m128i a, const __m128i b, __m128i &lo, __m128i &mid, __m128i &hi) {
+    lo = _mm_xor_si128(lo, _mm_clmulepi64_si128(a, b, 0x00));
+    hi = _mm_xor_si128(hi, _mm_clmulepi64_si128(a, b, 0x11));
+    mid = _mm_xor_si128(mid, _mm_clmulepi64_si128(a, b, 0x10));
+    mid = _mm_xor_si128(mid, _mm_clmulepi64_si128(a, b, 0x01));
+}
+
+/**
+ * Reduces an accumulated product modulo x^128 + x^7 + x^2 + x + 1.
+ * The operands are bit-reflected, so the product is shifted left by one first.
+ */
+PLUSAES_TARGET_PCLMUL
+inline __m128i pclmul_reduce(__m128i lo, const __m128i mid, __m128i hi) {
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    // shift hi:lo left by 1
+    __m128i c_lo = _mm_srli_epi32(lo, 31);
+    __m128i c_hi = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    const __m128i c_mid = _mm_srli_si128(c_lo, 12);
+    c_hi = _mm_slli_si128(c_hi, 4);
+    c_lo = _mm_slli_si128(c_lo, 4);
+    lo = _mm_or_si128(lo, c_lo);
+    hi = _mm_or_si128(hi, c_hi);
+    hi = _mm_or_si128(hi, c_mid);
+
+    // reduction
+    __m128i a = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+    const __m128i b = _mm_srli_si128(a, 4);
+    a = _mm_slli_si128(a, 12);
+    lo = _mm_xor_si128(lo, a);
+
+    __m128i d = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+    d = _mm_xor_si128(d, b);
+    lo = _mm_xor_si128(lo, d);
+
+    return _mm_xor_si128(hi, lo);
+}
+
+PLUSAES_TARGET_PCLMUL
+inline __m128i pclmul_mul(const __m128i a, const __m128i b) {
+    __m128i lo = _mm_setzero_si128(), mid = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    pclmul_mul_acc(a, b, lo, mid, hi);
+    return pclmul_reduce(lo, mid, hi);
+}
+
+PLUSAES_TARGET_PCLMUL
+inline void pclmul_init_powers(const unsigned char h[kGcmBlockSize], GcmTable &table) {
+    const __m128i h1 = pclmul_bswap(aesni_load(h));
+    __m128i hn = h1;
+    aesni_store(table.hpow[0], hn);
+    for (int i = 1; i < kPclmulGhashBlocks; ++i) {
+        hn = pclmul_mul(hn, h1);
+        aesni_store(table.hpow[i], hn);
+    }
+}
+
+/**
+ * y = (((y ^ x0) * H ^ x1) * H ... ^ x7) * H
+ *   = (y ^ x0) * H^8 ^ x1 * H^7 ^ ... ^ x7 * H with a single reduction.
+ */
+PLUSAES_TARGET_PCLMUL
+inline __m128i pclmul_ghash8(const __m128i hpow[kPclmulGhashBlocks], const __m128i y, const unsigned char *data) {
+    __m128i lo = _mm_setzero_si128(), mid = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    pclmul_mul_acc(_mm_xor_si128(y, pclmul_bswap(aesni_load(data))), hpow[kPclmulGhashBlocks - 1], lo, mid, hi);
+    for (int i = 1; i < kPclmulGhashBlocks; ++i) {
+        pclmul_mul_acc(pclmul_bswap(aesni_load(data + i * 16)), hpow[kPclmulGhashBlocks - 1 - i], lo, mid, hi);
+    }
+    return pclmul_reduce(lo, mid, hi);
+}
+
+PLUSAES_TARGET_PCLMUL
+inline void pclmul_ghash_update(const GcmTable &table, unsigned char y[kGcmBlockSize], const unsigned char *data, unsigned long size) {
+    __m128i hpow[kPclmulGhashBlocks];
+    for (int i = 0; i < kPclmulGhashBlocks; ++i) {
+        hpow[i] = aesni_load(table.hpow[i]);
+    }
+
+    __m128i x = pclmul_bswap(aesni_load(y));
+    for (; size >= kPclmulGhashBlocks * kGcmBlockSize; size -= kPclmulGhashBlocks * kGcmBlockSize) {
+        x = pclmul_ghash8(hpow, x, data);
+        data += kPclmulGhashBlocks * kGcmBlockSize;
+    }
+    for (; size >= kGcmBlockSize; size -= kGcmBlockSize) {
+        x = pclmul_mul(_mm_xor_si128(x, pclmul_bswap(aesni_load(data))), hpow[0]);
+        data += kGcmBlockSize;
+    }
+    if (size > 0) {
+        unsigned char last[kGcmBlockSize] = {};
+        memcpy(last, data, size);
+        x = pclmul_mul(_mm_xor_si128(x, pclmul_bswap(aesni_load(last))), hpow[0]);
+    }
+    aesni_store(y, pclmul_bswap(x));
+}
+
+/**
+ * Encrypts or decrypts whole batches of 8 blocks in-place with GCM.
+ * GHASH of one batch is interleaved with the AES rounds of the counter blocks,
+ * so PCLMULQDQ and AESENC run in parallel. Encryption hashes the previous batch,
+ * decryption hashes the current batch before overwriting it.
+ * @return Processed size in bytes.
+ */
+template<int Nr>
+PLUSAES_TARGET_PCLMUL
+inline unsigned long aesni_gcm_crypt_nr(
+    const RoundKeys &rkeys,
+    const GcmTable &table,
+    const unsigned char j0[kGcmBlockSize],
+    uint32_t &ctr,
+    unsigned char y[kGcmBlockSize],
+    unsigned char *data,
+    const unsigned long data_size,
+    const bool encrypts
+    ) {
+    const unsigned long batch_size = kAesniParallelBlocks * kGcmBlockSize;
+    const unsigned long nbatches = data_size / batch_size;
+    if (nbatches == 0) return 0;
+
+    __m128i rk[Nr + 1];
+    for (int i = 0; i <= Nr; ++i) {
+        rk[i] = aesni_load(&rkeys[i]);
+    }
+
+    __m128i hpow[kPclmulGhashBlocks];
+    for (int i = 0; i < kPclmulGhashBlocks; ++i) {
+        hpow[i] = aesni_load(table.hpow[i]);
+    }
+
+    // byte-reversed counter block without the 32-bit counter, which is in the lowest lane
+    const __m128i base = _mm_and_si128(pclmul_bswap(aesni_load(j0)), _mm_set_epi32(-1, -1, -1, 0));
+
+    __m128i x = pclmul_bswap(aesni_load(y));
+    const unsigned char *prev = NULL;
+
+    for (unsigned long n = 0; n < nbatches; ++n) {
+        unsigned char *p = data + n * batch_size;
+        const unsigned char *hashed = encrypts ? prev : p;
+
+        __m128i b[kAesniParallelBlocks];
+        for (int j = 0; j < kAesniParallelBlocks; ++j) {
+            const __m128i c = _mm_or_si128(base, _mm_cvtsi32_si128(static_cast<int>(ctr + j)));
+            b[j] = pclmul_bswap(c);
+        }
+        ctr += kAesniParallelBlocks;
+
+        __m128i lo = _mm_setzero_si128(), mid = _mm_setzero_si128(), hi = _mm_setzero_si128();
+        aesni_xor8(b, rk[0]);
+        for (int i = 0; i < kPclmulGhashBlocks; ++i) {
+            aesni_enc8(b, rk[1 + i]);
+            if (hashed) {
+                __m128i c = pclmul_bswap(aesni_load(hashed + i * 16));
+                if (i == 0) c = _mm_xor_si128(c, x);
+                pclmul_mul_acc(c, hpow[kPclmulGhashBlocks - 1 - i], lo, mid, hi);
+            }
+        }
+        for (int i = kPclmulGhashBlocks + 1; i < Nr; ++i) {
+            aesni_enc8(b, rk[i]);
+        }
+        aesni_enclast8(b, rk[Nr]);
+        if (hashed) {
+            x = pclmul_reduce(lo, mid, hi);
+        }
+
+        for (int j = 0; j < kAesniParallelBlocks; ++j) {
+            aesni_store(p + j * 16, _mm_xor_si128(aesni_load(p + j * 16), b[j]));
+        }
+        prev = p;
+    }
+
+    if (encrypts) {
+        x = pclmul_ghash8(hpow, x, prev);
+    }
+    aesni_store(y, pclmul_bswap(x));
+
+    return nbatches * batch_size;
+}
+
+PLUSAES_TARGET_PCLMUL
+inline unsigned long aesni_gcm_crypt(
+    const RoundKeys &rkeys,
+    const GcmTable &table,
+    const unsigned char j0[kGcmBlockSize],
+    uint32_t &ctr,
+    unsigned char y[kGcmBlockSize],
+    unsigned char *data,
+    const unsigned long data_size,
+    const bool encrypts
+    ) {
+    switch (get_rounds(rkeys)) {
+    case 10: return aesni_gcm_crypt_nr<10>(rkeys, table, j0, ctr, y, data, data_size, encrypts);
+    case 12: return aesni_gcm_crypt_nr<12>(rkeys, table, j0, ctr, y, data, data_size, encrypts);
+    default: return aesni_gcm_crypt_nr<14>(rkeys, table, j0, ctr, y, data, data_size, encrypts);
+    }
+}
+
+#endif // PLUSAES_HAS_AESNI
+
+inline void gcm_init_table(const unsigned char h[kGcmBlockSize], GcmTable &table) {
+    uint64_t vh = load_be64(h);
+    uint64_t vl = load_be64(h + 8);
+
+    table.hh[8] = vh;
+    table.hl[8] = vl;
+    table.hh[0] = 0;
+    table.hl[0] = 0;
+
+    // H * x, H * x^2, H * x^3 (bit-reflected halving)
+    for (int i = 4; i > 0; i >>= 1) {
+        const uint64_t t = (vl & 1) * (static_cast<uint64_t>(0xe1) << 56);
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ t;
+        table.hh[i] = vh;
+        table.hl[i] = vl;
+    }
+
+    // the others by linearity
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; ++j) {
+            table.hh[i + j] = table.hh[i] ^ table.hh[j];
+            table.hl[i + j] = table.hl[i] ^ table.hl[j];
+        }
+    }
+
+#if PLUSAES_HAS_AESNI
+    if (has_pclmul()) {
+        pclmul_init_powers(h, table);
+    }
+#endif
+}
+
+/** x = x * H in GF(2^128) */
+inline void gcm_mult(const GcmTable &table, unsigned char x[kGcmBlockSize]) {
+    int lo = x[15] & 0xf;
+    uint64_t zh = table.hh[lo];
+    uint64_t zl = table.hl[lo];
+
+    for (int i = 15; i >= 0; --i) {
+        lo = x[i] & 0xf;
+        const int hi = (x[i] >> 4) & 0xf;
+
+        if (i != 15) {
+            const int rem = static_cast<int>(zl & 0xf);
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ (kGcmLast4[rem] << 48);
+            zh ^= table.hh[lo];
+            zl ^= table.hl[lo];
+        }
+
+        const int rem = static_cast<int>(zl & 0xf);
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ (kGcmLast4[rem] << 48);
+        zh ^= table.hh[hi];
+        zl ^= table.hl[hi];
+    }
+
+    store_be64(x, zh);
+    store_be64(x + 8, zl);
+}
+
+/** Absorbs data into the GHASH state y. The last partial block is padded with zeros. */
+inline void ghash_update(const GcmTable &table, unsigned char y[kGcmBlockSize], const unsigned char *data, const unsigned long size) {
+#if PLUSAES_HAS_AESNI
+    if (has_pclmul()) {
+        pclmul_ghash_update(table, y, data, size);
+        return;
+    }
+#endif
+
+    unsigned long i = 0;
+    for (; i + kGcmBlockSize <= size; i += kGcmBlockSize) {
+        xor_bytes(y, data + i, kGcmBlockSize);
+        gcm_mult(table, y);
+    }
+    if (i < size) {
+        xor_bytes(y, data + i, size - i);
+        gcm_mult(table, y);
+    }
+}
+
+inline void encrypt_state_ref(const RoundKeys &rkeys, const unsigned char data[16], unsigned char encrypted[16]) {
+    State s;
+    copy_bytes_to_state(data, s);
+
+    add_round_key(rkeys[0], s);
+
+    for (unsigned int i = 1; i < rkeys.size() - 1; ++i) {
+        sub_bytes(s);
+        shift_rows(s);
+        mix_columns(s);
+        add_round_key(rkeys[i], s);
+    }
+
+    sub_bytes(s);
+    shift_rows(s);
+    add_round_key(rkeys.back(), s);
+
+    copy_state_to_bytes(s, encrypted);
+}
+
+/** Equivalent inverse cipher (FIPS-197 5.3.5). It takes the decryption round keys. */
+inline void decrypt_state_ref(const RoundKeys &dkeys, const unsigned char data[16], unsigned char decrypted[16]) {
+    State s;
+    copy_bytes_to_state(data, s);
+
+    add_round_key(dkeys.back(), s);
+
+    for (std::size_t i = dkeys.size() - 2; i > 0; --i) {
+        inv_sub_bytes(s);
+        inv_shift_rows(s);
+        inv_mix_columns(s);
+        add_round_key(dkeys[i], s);
+    }
+
+    inv_sub_bytes(s);
+    inv_shift_rows(s);
+    add_round_key(dkeys[0], s);
+
+    copy_state_to_bytes(s, decrypted);
+}
+
+inline Word te_round(const State &s, const int c) {
+    return kTe0[(s[c]                        ) & 0xFF] ^
+           kTe1[(s[(c + 1) % kBlockSize] >>  8) & 0xFF] ^
+           kTe2[(s[(c + 2) % kBlockSize] >> 16) & 0xFF] ^
+           kTe3[(s[(c + 3) % kBlockSize] >> 24)       ];
+}
+
+inline Word te_last_round(const State &s, const int c) {
+    return (kTe4[(s[c]                        ) & 0xFF] & 0x000000FF) ^
+           (kTe4[(s[(c + 1) % kBlockSize] >>  8) & 0xFF] & 0x0000FF00) ^
+           (kTe4[(s[(c + 2) % kBlockSize] >> 16) & 0xFF] & 0x00FF0000) ^
+           (kTe4[(s[(c + 3) % kBlockSize] >> 24)       ] & 0xFF000000);
+}
+
+inline Word td_round(const State &s, const int c) {
+    return kTd0[(s[c]                        ) & 0xFF] ^
+           kTd1[(s[(c + 3) % kBlockSize] >>  8) & 0xFF] ^
+           kTd2[(s[(c + 2) % kBlockSize] >> 16) & 0xFF] ^
+           kTd3[(s[(c + 1) % kBlockSize] >> 24)       ];
+}
+
+inline Word td_last_round(const State &s, const int c) {
+    return (kTd4[(s[c]                        ) & 0xFF] & 0x000000FF) ^
+           (kTd4[(s[(c + 3) % kBlockSize] >>  8) & 0xFF] & 0x0000FF00) ^
+           (kTd4[(s[(c + 2) % kBlockSize] >> 16) & 0xFF] & 0x00FF0000) ^
+           (kTd4[(s[(c + 1) % kBlockSize] >> 24)       ] & 0xFF000000);
+}
+
+/** InvMixColumns of a round key word by the T-tables (Td[Sbox[x]] cancels InvSubBytes). */
+inline Word td_inv_mix_word(const Word w) {
+    return kTd0[kSbox[(w      ) & 0xFF]] ^
+           kTd1[kSbox[(w >>  8) & 0xFF]] ^
+           kTd2[kSbox[(w >> 16) & 0xFF]] ^
+           kTd3[kSbox[(w >> 24)       ]];
+}
+
+template<int Nr>
+inline void encrypt_state_ttable_nr(const RoundKeys &rkeys, const unsigned char data[16], unsigned char encrypted[16]) {
+    State s, t;
+    copy_bytes_to_state(data, s);
+
+    add_round_key(rkeys[0], s);
+
+    for (int i = 1; i < Nr; ++i) {
+        const RoundKey &k = rkeys[i];
+        t[0] = te_round(s, 0) ^ k[0];
+        t[1] = te_round(s, 1) ^ k[1];
+        t[2] = te_round(s, 2) ^ k[2];
+        t[3] = te_round(s, 3) ^ k[3];
+        s = t;
+    }
+
+    const RoundKey &k = rkeys[Nr];
+    t[0] = te_last_round(s, 0) ^ k[0];
+    t[1] = te_last_round(s, 1) ^ k[1];
+    t[2] = te_last_round(s, 2) ^ k[2];
+    t[3] = te_last_round(s, 3) ^ k[3];
+
+    copy_state_to_bytes(t, encrypted);
+}
+
+inline void encrypt_state_ttable(const RoundKeys &rkeys, const unsigned char data[16], unsigned char encrypted[16]) {
+    switch (get_rounds(rkeys)) {
+    case 10: encrypt_state_ttable_nr<10>(rkeys, data, encrypted); break;
+    case 12: encrypt_state_ttable_nr<12>(rkeys, data, encrypted); break;
+    default: encrypt_state_ttable_nr<14>(rkeys, data, encrypted); break;
+    }
+}
+
+/** Decrypts by the equivalent inverse cipher (FIPS-197 5.3.5). It takes the decryption round keys. */
+template<int Nr>
+inline void decrypt_state_ttable_nr(const RoundKeys &dkeys, const unsigned char data[16], unsigned char decrypted[16]) {
+    State s, t;
+    copy_bytes_to_state(data, s);
+
+    add_round_key(dkeys[Nr], s);
+
+    for (int i = Nr - 1; i > 0; --i) {
+        const RoundKey &k = dkeys[i];
+        t[0] = td_round(s, 0) ^ k[0];
+        t[1] = td_round(s, 1) ^ k[1];
+        t[2] = td_round(s, 2) ^ k[2];
+        t[3] = td_round(s, 3) ^ k[3];
+        s = t;
+    }
+
+    const RoundKey &k = dkeys[0];
+    t[0] = td_last_round(s, 0) ^ k[0];
+    t[1] = td_last_round(s, 1) ^ k[1];
+    t[2] = td_last_round(s, 2) ^ k[2];
+    t[3] = td_last_round(s, 3) ^ k[3];
+
+    copy_state_to_bytes(t, decrypted);
+}
+
+inline void decrypt_state_ttable(const RoundKeys &dkeys, const unsigned char data[16], unsigned char decrypted[16]) {
+    switch (get_rounds(dkeys)) {
+    case 10: decrypt_state_ttable_nr<10>(dkeys, data, decrypted); break;
+    case 12: decrypt_state_ttable_nr<12>(dkeys, data, decrypted); break;
+    default: decrypt_state_ttable_nr<14>(dkeys, data, decrypted); break;
+    }
+}
+
+/**
+ * The T-table rounds are bound by table loads and already have four independent
+ * columns in flight, so interleaving blocks only adds register pressure.
+ * The blocks are processed one by one.
+ */
+template<int Nr>
+inline void encrypt_blocks_ttable_nr(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    for (; nblocks > 0; --nblocks) {
+        encrypt_state_ttable_nr<Nr>(rkeys, in, out);
+        in += kStateSize;
+        out += kStateSize;
+    }
+}
+
+inline void encrypt_blocks_ttable(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    switch (get_rounds(rkeys)) {
+    case 10: encrypt_blocks_ttable_nr<10>(rkeys, in, out, nblocks); break;
+    case 12: encrypt_blocks_ttable_nr<12>(rkeys, in, out, nblocks); break;
+    default: encrypt_blocks_ttable_nr<14>(rkeys, in, out, nblocks); break;
+    }
+}
+
+template<int Nr>
+inline void decrypt_blocks_ttable_nr(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    for (; nblocks > 0; --nblocks) {
+        decrypt_state_ttable_nr<Nr>(dkeys, in, out);
+        in += kStateSize;
+        out += kStateSize;
+    }
+}
+
+inline void decrypt_blocks_ttable(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    switch (get_rounds(dkeys)) {
+    case 10: decrypt_blocks_ttable_nr<10>(dkeys, in, out, nblocks); break;
+    case 12: decrypt_blocks_ttable_nr<12>(dkeys, in, out, nblocks); break;
+    default: decrypt_blocks_ttable_nr<14>(dkeys, in, out, nblocks); break;
+    }
+}
+
+/**
+ * Builds the round keys of the equivalent inverse cipher (FIPS-197 5.3.5):
+ * the same order as rkeys, with InvMixColumns applied to rounds 1..Nr-1.
+ */
+inline RoundKeys expand_decrypt_key(const RoundKeys &rkeys) {
+    RoundKeys dkeys(rkeys);
+
+#if PLUSAES_HAS_AESNI
+    if (has_aesni()) {
+        aesni_inv_mix_round_keys(dkeys);
+        return dkeys;
+    }
+#endif
+    // the T-tables only for the table backends, the arithmetic InvMixColumns for the constant-time ones
+#if PLUSAES_USE_TTABLE
+    const bool uses_tables = !uses_constant_time_rounds();
+#else
+    const bool uses_tables = false;
+#endif
+    for (std::size_t i = 1; i + 1 < dkeys.size(); ++i) {
+        if (uses_tables) {
+            for (int c = 0; c < kBlockSize; ++c) {
+                dkeys[i][c] = td_inv_mix_word(rkeys[i][c]);
+            }
+        }
+        else {
+            inv_mix_columns(dkeys[i]);
+        }
+    }
+
+    return dkeys;
+}
+
+/** Encrypts nblocks blocks one by one with the reference rounds. */
+inline void encrypt_blocks_ref(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    for (std::size_t i = 0; i < nblocks; ++i) {
+        encrypt_state_ref(rkeys, in + i * kStateSize, out + i * kStateSize);
+    }
+}
+
+inline void decrypt_blocks_ref(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    for (std::size_t i = 0; i < nblocks; ++i) {
+        decrypt_state_ref(dkeys, in + i * kStateSize, out + i * kStateSize);
+    }
+}
+
+inline void bs_encrypt_state(const RoundKeys &rkeys, const unsigned char data[16], unsigned char encrypted[16]) {
+    bs_encrypt_blocks_u64(rkeys, data, encrypted, 1);
+}
+
+inline void bs_decrypt_state(const RoundKeys &dkeys, const unsigned char data[16], unsigned char decrypted[16]) {
+    bs_decrypt_blocks_u64(dkeys, data, decrypted, 1);
+}
+
+inline void bs_encrypt_blocks(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    bs_crypt_blocks(rkeys, in, out, nblocks, true);
+}
+
+inline void bs_decrypt_blocks(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    bs_crypt_blocks(dkeys, in, out, nblocks, false);
+}
+
+#if PLUSAES_HAS_AESNI
+inline void vp_encrypt_blocks(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    for (std::size_t i = 0; i < nblocks; ++i) {
+        vp_encrypt_state(rkeys, in + i * kStateSize, out + i * kStateSize);
+    }
+}
+
+inline void vp_decrypt_blocks(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    for (std::size_t i = 0; i < nblocks; ++i) {
+        vp_decrypt_state(dkeys, in + i * kStateSize, out + i * kStateSize);
+    }
+}
+#endif
+
+#if PLUSAES_HAS_VAES
+inline void vaes_encrypt_blocks(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    if (!vaes_crypt_blocks(rkeys, in, out, nblocks, true)) {
+        aesni_encrypt_blocks(rkeys, in, out, nblocks);
+    }
+}
+
+inline void vaes_decrypt_blocks(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    if (!vaes_crypt_blocks(dkeys, in, out, nblocks, false)) {
+        aesni_decrypt_blocks(dkeys, in, out, nblocks);
+    }
+}
+#endif
+
+/** Block cipher kernels of a backend. All of them take the same round keys. */
+struct BlockCipher {
+    Backend backend;
+    void (*encrypt_state)(const RoundKeys &rkeys, const unsigned char data[16], unsigned char encrypted[16]);
+    void (*decrypt_state)(const RoundKeys &dkeys, const unsigned char data[16], unsigned char decrypted[16]);
+    void (*encrypt_blocks)(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks);
+    void (*decrypt_blocks)(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks);
+};
+
+/**
+ * Returns the kernels of backend, or null if it is not compiled in or the CPU lacks it.
+ * They are constants initialized before the program runs, so they can be shared between threads.
+ */
+inline const BlockCipher *find_block_cipher(const Backend backend) {
+    switch (backend) {
+    case kBackendReference: {
+        static const BlockCipher c = {kBackendReference, encrypt_state_ref, decrypt_state_ref, encrypt_blocks_ref, decrypt_blocks_ref};
+        return &c;
+    }
+    case kBackendTTable: {
+        static const BlockCipher c = {kBackendTTable, encrypt_state_ttable, decrypt_state_ttable, encrypt_blocks_ttable, decrypt_blocks_ttable};
+        return &c;
+    }
+    case kBackendBitslice: {
+        static const BlockCipher c = {kBackendBitslice, bs_encrypt_state, bs_decrypt_state, bs_encrypt_blocks, bs_decrypt_blocks};
+        return &c;
+    }
+#if PLUSAES_HAS_AESNI
+    case kBackendVperm: {
+        static const BlockCipher c = {kBackendVperm, vp_encrypt_state, vp_decrypt_state, vp_encrypt_blocks, vp_decrypt_blocks};
+        return has_ssse3() ? &c : 0;
+    }
+    case kBackendAesni: {
+        static const BlockCipher c = {kBackendAesni, aesni_encrypt_state, aesni_decrypt_state, aesni_encrypt_blocks, aesni_decrypt_blocks};
+        return has_aesni() ? &c : 0;
+    }
+#endif
+#if PLUSAES_HAS_VAES
+    case kBackendVaes: {
+        static const BlockCipher c = {kBackendVaes, aesni_encrypt_state, aesni_decrypt_state, vaes_encrypt_blocks, vaes_decrypt_blocks};
+        return has_vaes_avx2() ? &c : 0;
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+/** Fastest backend that the CPU supports, among the ones enabled by the PLUSAES_USE_* macros. */
+inline Backend get_default_backend() {
+    const Backend order[] = {
+        kBackendVaes, kBackendAesni,
+#if PLUSAES_USE_VPERM
+        kBackendVperm,
+#endif
+#if PLUSAES_USE_BITSLICE
+        kBackendBitslice,
+#elif PLUSAES_USE_TTABLE
+        kBackendTTable,
+#endif
+    };
+    for (std::size_t i = 0; i < sizeof(order) / sizeof(order[0]); ++i) {
+        if (find_block_cipher(order[i])) {
+            return order[i];
+        }
+    }
+    return kBackendReference;
+}
+
+/** Backend named name ("aesni", ...), or kBackendAuto if the name is unknown. */
+inline Backend parse_backend(const char *name) {
+    const Backend backends[] = {
+        kBackendReference, kBackendTTable, kBackendBitslice, kBackendVperm, kBackendAesni, kBackendVaes
+    };
+    for (std::size_t i = 0; name && i < sizeof(backends) / sizeof(backends[0]); ++i) {
+        if (strcmp(name, backend_name(backends[i])) == 0) {
+            return backends[i];
+        }
+    }
+    return kBackendAuto;
+}
+
+/** Backend forced by the PLUSAES_BACKEND environment variable, or kBackendAuto. */
+inline Backend get_env_backend() {
+#if defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable: 4996)
+#endif
+    return parse_backend(getenv("PLUSAES_BACKEND"));
+#if defined(_MSC_VER)
+#pragma warning(pop)
+#endif
+}
+
+inline const BlockCipher *resolve_block_cipher(const Backend backend) {
+    const BlockCipher *c = backend == kBackendAuto ? 0 : find_block_cipher(backend);
+    return c ? c : find_block_cipher(get_default_backend());
+}
+
+/**
+ * Pointer that is loaded, stored and compared-and-swapped atomically.
+ * It has no constructor, so a static one is null before the program runs.
+ * The pointees are constants, so the accesses need no ordering.
+ */
+template<class T>
+struct AtomicPtr {
+#if PLUSAES_HAS_STD_ATOMIC
+    std::atomic<T *> p;
+
+    T *load() const { return p.load(std::memory_order_relaxed); }
+    void store(T *v) { p.store(v, std::memory_order_relaxed); }
+    bool compare_exchange(T *expected, T *desired) {
+        return p.compare_exchange_strong(expected, desired, std::memory_order_relaxed);
+    }
+#elif defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+    T *p;
+
+    T *load() const { return __atomic_load_n(&p, __ATOMIC_RELAXED); }
+    void store(T *v) { __atomic_store_n(&p, v, __ATOMIC_RELAXED); }
+    bool compare_exchange(T *expected, T *desired) {
+        return __atomic_compare_exchange_n(&p, &expected, desired, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+#elif defined(__GNUC__)
+    T *volatile p;
+
+    T *load() const { return p; }
+    void store(T *v) { p = v; }
+    bool compare_exchange(T *expected, T *desired) {
+        return __sync_bool_compare_and_swap(&p, expected, desired);
+    }
+#elif defined(_MSC_VER)
+    T *volatile p;
+
+    T *load() const { return p; }
+    void store(T *v) { p = v; }
+    bool compare_exchange(T *expected, T *desired) {
+        return _InterlockedCompareExchangePointer(reinterpret_cast<void *volatile *>(&p),
+            const_cast<void *>(static_cast<const void *>(desired)),
+            const_cast<void *>(static_cast<const void *>(expected))) == expected;
+    }
+#else
+#error "plusaes needs std::atomic or atomic builtins for the backend selection"
+#endif
+};
+
+/** Active kernels, null until the first block_cipher() or set_backend(). */
+inline AtomicPtr<const BlockCipher> &active_block_cipher() {
+    static AtomicPtr<const BlockCipher> active;
+    return active;
+}
+
+/**
+ * Kernels used by encrypt_state/decrypt_state/encrypt_blocks/decrypt_blocks.
+ * Resolved at the first use, so the CPUID checks are not repeated per call.
+ * set_backend may replace them while other threads run, so a call reads them once
+ * per block operation; every backend gives the same results for the same round keys.
+ */
+inline const BlockCipher &block_cipher() {
+    AtomicPtr<const BlockCipher> &active = active_block_cipher();
+    const BlockCipher *c = active.load();
+    if (!c) {
+        // racing first uses resolve the same kernels, and a set_backend in between is kept
+        const BlockCipher *resolved = resolve_block_cipher(get_env_backend());
+        c = active.compare_exchange(0, resolved) ? resolved : active.load();
+    }
+    return *c;
+}
+
+/** True if the active backend has no key or data dependent memory accesses (bitslice, vperm). */
+inline bool uses_constant_time_rounds() {
+    const Backend backend = block_cipher().backend;
+    return backend == kBackendBitslice || backend == kBackendVperm;
+}
+
+inline void encrypt_state(const RoundKeys &rkeys, const unsigned char data[16], unsigned char encrypted[16]) {
+    block_cipher().encrypt_state(rkeys, data, encrypted);
+}
+
+/** Decrypts a block with the decryption round keys (expand_decrypt_key). */
+inline void decrypt_state(const RoundKeys &dkeys, const unsigned char data[16], unsigned char decrypted[16]) {
+    block_cipher().decrypt_state(dkeys, data, decrypted);
+}
+
+/** Encrypts nblocks independent blocks. in and out may be the same buffer. */
+inline void encrypt_blocks(const RoundKeys &rkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    block_cipher().encrypt_blocks(rkeys, in, out, nblocks);
+}
+
+/**
+ * Decrypts nblocks independent blocks with the decryption round keys (expand_decrypt_key).
+ * in and out may be the same buffer.
+ */
+inline void decrypt_blocks(const RoundKeys &dkeys, const unsigned char *in, unsigned char *out, std::size_t nblocks) {
+    block_cipher().decrypt_blocks(dkeys, in, out, nblocks);
+}
+
+template<int KeyLen>
+std::vector<unsigned char> key_from_string(const char (*key_str)[KeyLen]) {
+    std::vector<unsigned char> key(KeyLen - 1);
+    memcpy(&key[0], *key_str, KeyLen - 1);
+    return key;
+}
+
+inline bool is_valid_key_size(const unsigned long key_size) {
+    if (key_size != 16 && key_size != 24 && key_size != 32) {
+        return false;
+    }
+    else {
+        return true;
+    }
+}
+
+} // namespace detail
+
+/** Version number of plusaes. */
+inline unsigned int version() {
+    return PLUSAES_VERSION;
+}
+
+/** Create 128-bit key from string. */
+inline std::vector<unsigned char> key_from_string(const char (*key_str)[17]) {
+    return detail::key_from_string<17>(key_str);
+}
+
+/** Create 192-bit key from string. */
+inline std::vector<unsigned char> key_from_string(const char (*key_str)[25]) {
+    return detail::key_from_string<25>(key_str);
+}
+
+/** Create 256-bit key from string. */
+inline std::vector<unsigned char> key_from_string(const char (*key_str)[33]) {
+    return detail::key_from_string<33>(key_str);
+}
+
+/** Calculates encrypted data size when padding is enabled. */
+inline unsigned long get_padded_encrypted_size(const unsigned long data_size) {
+    return data_size + detail::kStateSize - (data_size % detail::kStateSize);
+}
+
+/** Error code */
+typedef enum {
+    kErrorOk = 0,
+    kErrorInvalidDataSize = 1,
+    kErrorInvalidKeySize,
+    kErrorInvalidBufferSize,
+    kErrorInvalidKey,
+    kErrorInvalidNonceSize,
+    kErrorInvalidIvSize,
+    kErrorInvalidTagSize,
+    kErrorInvalidTag,
+    kErrorUnsupportedBackend
+} Error;
+
+/**
+ * Returns the backend that encrypts and decrypts the blocks.
+ * It is chosen at the first use from the CPU features, unless the PLUSAES_BACKEND
+ * environment variable names a supported one ("reference", "ttable", "bitslice",
+ * "vperm", "aesni" or "vaes"). Key expansion and GHASH do not depend on it.
+ */
+inline Backend active_backend() {
+    return detail::block_cipher().backend;
+}
+
+/** Returns true if backend is compiled in and the CPU supports it. */
+inline bool is_backend_supported(const Backend backend) {
+    return backend == kBackendAuto || detail::find_block_cipher(backend) != 0;
+}
+
+/**
+ * Forces backend for all following calls, or restores the default with kBackendAuto.
+ * The round keys of a KeySchedule work with every backend.
+ * It may be called while other threads encrypt or decrypt: their block operations
+ * use the previous or the new backend, which give the same results.
+ * @return kErrorUnsupportedBackend if is_backend_supported(backend) is false. The backend is unchanged then.
+ */
+inline Error set_backend(const Backend backend) {
+    if (!is_backend_supported(backend)) {
+        return kErrorUnsupportedBackend;
+    }
+    detail::active_block_cipher().store(detail::resolve_block_cipher(backend));
+    return kErrorOk;
+}
+
+namespace detail {
+
+inline Error check_encrypt_cond(
+    const unsigned long data_size,
+    const unsigned long key_size,
+    const unsigned long encrypted_size,
+    const bool pads) {
+    // check data size
+    if (!pads && (data_size % kStateSize != 0)) {
+        return kErrorInvalidDataSize;
+    }
+
+    // check key size
+    if (!detail::is_valid_key_size(key_size)) {
+        return kErrorInvalidKeySize;
+    }
+
+    // check encrypted buffer size
+    if (pads) {
+        const unsigned long required_size = get_padded_encrypted_size(data_size);
+        if (encrypted_size < required_size) {
+            return kErrorInvalidBufferSize;
+        }
+    }
+    else {
+        if (encrypted_size < data_size) {
+            return kErrorInvalidBufferSize;
+        }
+    }
+    return kErrorOk;
+}
+
+inline Error check_decrypt_cond(
+    const unsigned long data_size,
+    const unsigned long key_size,
+    const unsigned long decrypted_size,
     const unsigned long * padded_size
     ) {
     // check data size
@@ -455,64 +3272,307 @@ inline bool check_padding(const unsigned long padding, const unsigned char data[
     return true;
 }
 
+inline bool is_valid_gcm_tag_size(const unsigned long tag_size) {
+    return tag_size == 4 || tag_size == 8 || (tag_size >= 12 && tag_size <= kGcmBlockSize);
+}
+
+/** Returns true if data_size is at most 2^32 - 2 blocks (SP 800-38D), so that inc32 never wraps the counter back to J0. */
+inline bool is_valid_gcm_data_size(const unsigned long data_size) {
+    return static_cast<uint64_t>(data_size) <= static_cast<uint64_t>(0xFFFFFFFEu) * kGcmBlockSize;
+}
+
+/** Returns true if the bit length of the additional authenticated data fits in 64 bits (SP 800-38D). */
+inline bool is_valid_gcm_aad_size(const unsigned long aad_size) {
+    return static_cast<uint64_t>(aad_size) <= (~static_cast<uint64_t>(0) >> 3);
+}
+
+/** Writes n GCM counter blocks. Only the low 32 bits of the counter are incremented (inc32). */
+inline void make_gcm_counter_blocks(const unsigned char j0[kGcmBlockSize], uint32_t &ctr, unsigned char *blocks, const unsigned long n) {
+    for (unsigned long i = 0; i < n; ++i) {
+        unsigned char *b = blocks + i * kGcmBlockSize;
+        memcpy(b, j0, 12);
+        b[12] = static_cast<unsigned char>(ctr >> 24);
+        b[13] = static_cast<unsigned char>(ctr >> 16);
+        b[14] = static_cast<unsigned char>(ctr >> 8);
+        b[15] = static_cast<unsigned char>(ctr);
+        ++ctr;
+    }
+}
+
+/**
+ * Encrypts or decrypts data in-place with GCM and computes the full 16 bytes tag.
+ * GHASH is computed over the ciphertext of each batch, after encryption or before decryption.
+ */
+inline void gcm_crypt(
+    const RoundKeys &rkeys,
+    const GcmTable &table,
+    unsigned char *data,
+    const unsigned long data_size,
+    const unsigned char *aad,
+    const unsigned long aad_size,
+    const unsigned char *iv,
+    const unsigned long iv_size,
+    const bool encrypts,
+    unsigned char tag[kGcmBlockSize]
+    ) {
+    // pre-counter block
+    unsigned char j0[kGcmBlockSize] = {};
+    if (iv_size == 12) {
+        memcpy(j0, iv, iv_size);
+        j0[15] = 1;
+    }
+    else {
+        unsigned char len_block[kGcmBlockSize] = {};
+        store_be64(len_block + 8, static_cast<uint64_t>(iv_size) * 8);
+        ghash_update(table, j0, iv, iv_size);
+        ghash_update(table, j0, len_block, kGcmBlockSize);
+    }
+    uint32_t ctr = (static_cast<uint32_t>(j0[12]) << 24) | (static_cast<uint32_t>(j0[13]) << 16) |
+        (static_cast<uint32_t>(j0[14]) << 8) | static_cast<uint32_t>(j0[15]);
+
+    unsigned char ek_j0[kGcmBlockSize];
+    encrypt_state(rkeys, j0, ek_j0);
+    ++ctr;
+
+    unsigned char y[kGcmBlockSize] = {};
+    ghash_update(table, y, aad, aad_size);
+
+    unsigned char counters[kCtrBatchBlocks * kGcmBlockSize];
+    unsigned char blk[kCtrBatchBlocks * kGcmBlockSize];
+
+    unsigned long pos = 0;
+#if PLUSAES_HAS_AESNI
+    const Backend backend = block_cipher().backend;
+    if (has_pclmul() && (backend == kBackendAesni || backend == kBackendVaes)) {
+        pos = aesni_gcm_crypt(rkeys, table, j0, ctr, y, data, data_size, encrypts);
+    }
+#endif
+    while (pos < data_size) {
+        const unsigned long rem = data_size - pos;
+        const unsigned long rem_blocks = (rem + kGcmBlockSize - 1) / kGcmBlockSize;
+        const unsigned long n = (rem_blocks < kCtrBatchBlocks) ? rem_blocks : kCtrBatchBlocks;
+        const unsigned long len = (rem < n * kGcmBlockSize) ? rem : n * kGcmBlockSize;
+
+        make_gcm_counter_blocks(j0, ctr, counters, n);
+        encrypt_blocks(rkeys, counters, blk, n);
+
+        if (!encrypts) ghash_update(table, y, data + pos, len);
+        xor_bytes(data + pos, blk, len);
+        if (encrypts) ghash_update(table, y, data + pos, len);
+
+        pos += len;
+    }
+
+    unsigned char len_block[kGcmBlockSize];
+    store_be64(len_block, static_cast<uint64_t>(aad_size) * 8);
+    store_be64(len_block + 8, static_cast<uint64_t>(data_size) * 8);
+    ghash_update(table, y, len_block, kGcmBlockSize);
+
+    memcpy(tag, ek_j0, kGcmBlockSize);
+    xor_bytes(tag, y, kGcmBlockSize);
+}
+
+/** @private Parts of a KeySchedule to build. */
+enum KeyParts {
+    kKeyPartEncrypt = 1,  // encryption round keys
+    kKeyPartDecrypt = 2,  // decryption round keys (needs the encryption round keys)
+    kKeyPartGcm = 4,      // GHASH table (needs the encryption round keys)
+    kKeyPartAll = 7
+};
+
+} // namespace detail
+
+class KeySchedule;
+
+namespace detail {
+
+inline Error expand_key_parts(KeySchedule & key_schedule, const unsigned char * key, const unsigned long key_size, const int parts);
+
 } // namespace detail
 
+
 /**
- * Encrypts data with ECB mode.
+ * Expanded key.
+ *
+ * Expands the key once so that it can be reused by many encrypt/decrypt calls.
+ * The schedule is shared by encryption and decryption.
+ * Each mode function has an overload that takes this instead of the raw key.
+ * @since 1.0.0
+ */
+class KeySchedule {
+public:
+    /** Creates an empty (invalid) key schedule. */
+    KeySchedule() : key_size_(0) {}
+
+    /**
+     * Creates a key schedule from key bytes.
+     * If the key size is invalid, the schedule is left invalid
+     * and the mode functions return kErrorInvalidKeySize.
+     * @param [in]  key Key bytes. The key length must be 16 (128-bit), 24 (192-bit) or 32 (256-bit).
+     * @param [in]  key_size Key size.
+     */
+    KeySchedule(const unsigned char * key, const unsigned long key_size) : key_size_(0) {
+        set_key(key, key_size);
+    }
+
+    /**
+     * Expands the key and replaces the current schedule.
+     * @param [in]  key Key bytes. The key length must be 16 (128-bit), 24 (192-bit) or 32 (256-bit).
+     * @param [in]  key_size Key size.
+     */
+    Error set_key(const unsigned char * key, const unsigned long key_size) {
+        return expand(key, key_size, detail::kKeyPartAll);
+    }
+
+    /** Returns true if the schedule holds an expanded key. */
+    bool is_valid() const {
+        return key_size_ != 0;
+    }
+
+    /** Key size in bytes. 0 if the schedule is invalid. */
+    unsigned long key_size() const {
+        return key_size_;
+    }
+
+    /** @private */
+    const detail::RoundKeys & round_keys() const {
+        return rkeys_;
+    }
+
+    /** @private Round keys of the equivalent inverse cipher. */
+    const detail::RoundKeys & decrypt_round_keys() const {
+        return dkeys_;
+    }
+
+    /** @private */
+    const detail::GcmTable & gcm_table() const {
+        return gcm_table_;
+    }
+
+private:
+    friend Error detail::expand_key_parts(KeySchedule &, const unsigned char *, unsigned long, int);
+
+    Error expand(const unsigned char * key, const unsigned long key_size, const int parts) {
+        if (!detail::is_valid_key_size(key_size)) {
+            key_size_ = 0;
+            rkeys_.clear();
+            dkeys_.clear();
+            return kErrorInvalidKeySize;
+        }
+
+        rkeys_ = detail::expand_key(key, static_cast<int>(key_size));
+        if (parts & detail::kKeyPartDecrypt) {
+            dkeys_ = detail::expand_decrypt_key(rkeys_);
+        }
+        key_size_ = key_size;
+
+        if (parts & detail::kKeyPartGcm) {
+            // GHASH key H = E(K, 0^128)
+            const unsigned char zero[detail::kGcmBlockSize] = {};
+            unsigned char h[detail::kGcmBlockSize];
+            detail::encrypt_state(rkeys_, zero, h);
+            detail::gcm_init_table(h, gcm_table_);
+        }
+
+        return kErrorOk;
+    }
+
+    detail::RoundKeys rkeys_;
+    detail::RoundKeys dkeys_;
+    unsigned long key_size_;
+    detail::GcmTable gcm_table_;
+};
+
+namespace detail {
+
+/**
+ * Expands only the given parts (KeyParts) of the key into key_schedule.
+ * The raw key overloads use it, so that a single call expands only what its mode reads.
+ * The result is only valid for the modes that read those parts; it must not leave the call.
+ */
+inline Error expand_key_parts(KeySchedule & key_schedule, const unsigned char * key, const unsigned long key_size, const int parts) {
+    return key_schedule.expand(key, key_size, parts);
+}
+
+} // namespace detail
+
+/**
+ * Encrypts data with ECB mode using an expanded key.
  * @param [in]  data Data.
  * @param [in]  data_size Data size.
  *  If the pads is false, data size must be multiple of 16.
- * @param [in]  key key bytes. The key length must be 16 (128-bit), 24 (192-bit) or 32 (256-bit).
- * @param [in]  key_size key size.
+ * @param [in]  key_schedule Expanded key.
  * @param [out] encrypted Encrypted data buffer.
  * @param [in]  encrypted_size Encrypted data buffer size.
  * @param [in]  pads If this value is true, encrypted data is padded by PKCS.
- *  Encrypted data size must be multiple of 16.
- *  If the pads is true, encrypted data is padded with PKCS.
- *  So the data is multiple of 16, encrypted data size needs additonal 16 bytes.
  * @since 1.0.0
  */
 inline Error encrypt_ecb(
     const unsigned char * data,
     const unsigned long data_size,
-    const unsigned char * key,
-    const unsigned long key_size,
-    unsigned char *encrypted,
+    const KeySchedule & key_schedule,
+    unsigned char * encrypted,
     const unsigned long encrypted_size,
     const bool pads
     ) {
-    const Error e = detail::check_encrypt_cond(data_size, key_size, encrypted_size, pads);
+    const Error e = detail::check_encrypt_cond(data_size, key_schedule.key_size(), encrypted_size, pads);
     if (e != kErrorOk) {
         return e;
     }
 
-    const detail::RoundKeys rkeys = detail::expand_key(key, static_cast<int>(key_size));
+    const detail::RoundKeys & rkeys = key_schedule.round_keys();
 
     const unsigned long bc = data_size / detail::kStateSize;
-    for (unsigned long i = 0; i < bc; ++i) {
-        detail::encrypt_state(rkeys, data + (i * detail::kStateSize), encrypted + (i * detail::kStateSize));
-    }
+    detail::encrypt_blocks(rkeys, data, encrypted, bc);
 
     if (pads) {
         const int rem = data_size % detail::kStateSize;
         const char pad_v = detail::kStateSize - rem;
 
-        std::vector<unsigned char> ib(detail::kStateSize, pad_v), ob(detail::kStateSize);
-        memcpy(&ib[0], data + data_size - rem, rem);
+        unsigned char ib[detail::kStateSize];
+        memset(ib, pad_v, sizeof(ib));
+        memcpy(ib, data + data_size - rem, rem);
 
-        detail::encrypt_state(rkeys, &ib[0], &ob[0]);
-        memcpy(encrypted + (data_size - rem), &ob[0], detail::kStateSize);
+        detail::encrypt_state(rkeys, ib, encrypted + (data_size - rem));
     }
 
     return kErrorOk;
 }
 
 /**
- * Decrypts data with ECB mode.
+ * Encrypts data with ECB mode.
+ * @param [in]  data Data.
+ * @param [in]  data_size Data size.
+ *  If the pads is false, data size must be multiple of 16.
+ * @param [in]  key key bytes. The key length must be 16 (128-bit), 24 (192-bit) or 32 (256-bit).
+ * @param [in]  key_size key size.
+ * @param [out] encrypted Encrypted data buffer.
+ * @param [in]  encrypted_size Encrypted data buffer size.
+ * @param [in]  pads If this value is true, encrypted data is padded by PKCS.
+ *  Encrypted data size must be multiple of 16.
+ *  If the pads is true, encrypted data is padded with PKCS.
+ *  So the data is multiple of 16, encrypted data size needs additonal 16 bytes.
+ * @since 1.0.0
+ */
+inline Error encrypt_ecb(
+    const unsigned char * data,
+    const unsigned long data_size,
+    const unsigned char * key,
+    const unsigned long key_size,
+    unsigned char *encrypted,
+    const unsigned long encrypted_size,
+    const bool pads
+    ) {
+    KeySchedule key_schedule;
+    detail::expand_key_parts(key_schedule, key, key_size, detail::kKeyPartEncrypt);
+    return encrypt_ecb(data, data_size, key_schedule, encrypted, encrypted_size, pads);
+}
+
+/**
+ * Decrypts data with ECB mode using an expanded key.
  * @param [in]  data Data bytes.
  * @param [in]  data_size Data size.
- * @param [in]  key Key bytes.
- * @param [in]  key_size Key size.
+ * @param [in]  key_schedule Expanded key.
  * @param [out] decrypted Decrypted data buffer.
  * @param [in]  decrypted_size Decrypted data buffer size.
  * @param [out] padded_size If this value is NULL, this function does not remove padding.
@@ -523,26 +3583,23 @@ inline Error encrypt_ecb(
 inline Error decrypt_ecb(
     const unsigned char * data,
     const unsigned long data_size,
-    const unsigned char * key,
-    const unsigned long key_size,
+    const KeySchedule & key_schedule,
     unsigned char * decrypted,
     const unsigned long decrypted_size,
     unsigned long * padded_size
     ) {
-    const Error e = detail::check_decrypt_cond(data_size, key_size, decrypted_size, padded_size);
+    const Error e = detail::check_decrypt_cond(data_size, key_schedule.key_size(), decrypted_size, padded_size);
     if (e != kErrorOk) {
         return e;
     }
 
-    const detail::RoundKeys rkeys = detail::expand_key(key, static_cast<int>(key_size));
+    const detail::RoundKeys & dkeys = key_schedule.decrypt_round_keys();
 
     const unsigned long bc = data_size / detail::kStateSize - 1;
-    for (unsigned long i = 0; i < bc; ++i) {
-        detail::decrypt_state(rkeys, data + (i * detail::kStateSize), decrypted + (i * detail::kStateSize));
-    }
+    detail::decrypt_blocks(dkeys, data, decrypted, bc);
 
     unsigned char last[detail::kStateSize] = {};
-    detail::decrypt_state(rkeys, data + (bc * detail::kStateSize), last);
+    detail::decrypt_state(dkeys, data + (bc * detail::kStateSize), last);
 
     if (padded_size) {
         *padded_size = last[detail::kStateSize - 1];
@@ -566,12 +3623,38 @@ inline Error decrypt_ecb(
 }
 
 /**
- * Encrypt data with CBC mode.
+ * Decrypts data with ECB mode.
+ * @param [in]  data Data bytes.
+ * @param [in]  data_size Data size.
+ * @param [in]  key Key bytes.
+ * @param [in]  key_size Key size.
+ * @param [out] decrypted Decrypted data buffer.
+ * @param [in]  decrypted_size Decrypted data buffer size.
+ * @param [out] padded_size If this value is NULL, this function does not remove padding.
+ *  If this value is not NULL, this function removes padding by PKCS
+ *  and returns padded size using padded_size.
+ * @since 1.0.0
+ */
+inline Error decrypt_ecb(
+    const unsigned char * data,
+    const unsigned long data_size,
+    const unsigned char * key,
+    const unsigned long key_size,
+    unsigned char * decrypted,
+    const unsigned long decrypted_size,
+    unsigned long * padded_size
+    ) {
+    KeySchedule key_schedule;
+    detail::expand_key_parts(key_schedule, key, key_size, detail::kKeyPartEncrypt | detail::kKeyPartDecrypt);
+    return decrypt_ecb(data, data_size, key_schedule, decrypted, decrypted_size, padded_size);
+}
+
+/**
+ * Encrypt data with CBC mode using an expanded key.
  * @param [in]  data Data.
  * @param [in]  data_size Data size.
  *  If the pads is false, data size must be multiple of 16.
- * @param [in]  key key bytes. The key length must be 16 (128-bit), 24 (192-bit) or 32 (256-bit).
- * @param [in]  key_size key size.
+ * @param [in]  key_schedule Expanded key.
  * @param [in]  iv Initialize vector.
  * @param [out] encrypted Encrypted data buffer.
  * @param [in]  encrypted_size Encrypted data buffer size.
@@ -584,19 +3667,18 @@ inline Error decrypt_ecb(
 inline Error encrypt_cbc(
     const unsigned char * data,
     const unsigned long data_size,
-    const unsigned char * key,
-    const unsigned long key_size,
+    const KeySchedule & key_schedule,
     const unsigned char (* iv)[16],
     unsigned char * encrypted,
     const unsigned long encrypted_size,
     const bool pads
     ) {
-    const Error e = detail::check_encrypt_cond(data_size, key_size, encrypted_size, pads);
+    const Error e = detail::check_encrypt_cond(data_size, key_schedule.key_size(), encrypted_size, pads);
     if (e != kErrorOk) {
         return e;
     }
 
-    const detail::RoundKeys rkeys = detail::expand_key(key, static_cast<int>(key_size));
+    const detail::RoundKeys & rkeys = key_schedule.round_keys();
 
     unsigned char s[detail::kStateSize] = {}; // encrypting data
 
@@ -630,24 +3712,59 @@ inline Error encrypt_cbc(
 
     // enctypt last
     if (pads && ge16) {
-        std::vector<unsigned char> ib(detail::kStateSize, pad_v), ob(detail::kStateSize);
-        memcpy(&ib[0], data + data_size - rem, rem);
+        unsigned char ib[detail::kStateSize];
+        memset(ib, pad_v, sizeof(ib));
+        memcpy(ib, data + data_size - rem, rem);
 
-        detail::xor_data(&ib[0], encrypted + (bc - 1) * detail::kStateSize);
+        detail::xor_data(ib, encrypted + (bc - 1) * detail::kStateSize);
 
-        detail::encrypt_state(rkeys, &ib[0], &ob[0]);
-        memcpy(encrypted + (data_size - rem), &ob[0], detail::kStateSize);
+        detail::encrypt_state(rkeys, ib, encrypted + (data_size - rem));
     }
 
     return kErrorOk;
 }
 
 /**
- * Decrypt data with CBC mode.
+ * Encrypt data with CBC mode.
+ * @param [in]  data Data.
+ * @param [in]  data_size Data size.
+ *  If the pads is false, data size must be multiple of 16.
+ * @param [in]  key key bytes. The key length must be 16 (128-bit), 24 (192-bit) or 32 (256-bit).
+ * @param [in]  key_size key size.
+ * @param [in]  iv Initialize vector.
+ * @param [out] encrypted Encrypted data buffer.
+ * @param [in]  encrypted_size Encrypted data buffer size.
+ * @param [in]  pads If this value is true, encrypted data is padded by PKCS.
+ *  Encrypted data size must be multiple of 16.
+ *  If the pads is true, encrypted data is padded with PKCS.
+ *  So the data is multiple of 16, encrypted data size needs additonal 16 bytes.
+ * @since 1.0.0
+ */
+inline Error encrypt_cbc(
+    const unsigned char * data,
+    const unsigned long data_size,
+    const unsigned char * key,
+    const unsigned long key_size,
+    const unsigned char (* iv)[16],
+    unsigned char * encrypted,
+    const unsigned long encrypted_size,
+    const bool pads
+    ) {
+    KeySchedule key_schedule;
+    detail::expand_key_parts(key_schedule, key, key_size, detail::kKeyPartEncrypt);
+    return encrypt_cbc(data, data_size, key_schedule, iv, encrypted, encrypted_size, pads);
+}
+
+/**
+ * Decrypt data with CBC mode using an expanded key.
+ *
+ * Blocks are decrypted in batches, since CBC decryption has no dependency between blocks.
+ * A large buffer can also be split across threads at block boundaries:
+ * each range is decrypted with the last ciphertext block before it as the iv,
+ * and only the last range removes padding.
  * @param [in]  data Data bytes.
  * @param [in]  data_size Data size.
- * @param [in]  key Key bytes.
- * @param [in]  key_size Key size.
+ * @param [in]  key_schedule Expanded key.
  * @param [in]  iv Initialize vector.
  * @param [out] decrypted Decrypted data buffer.
  * @param [in]  decrypted_size Decrypted data buffer size.
@@ -659,38 +3776,39 @@ inline Error encrypt_cbc(
 inline Error decrypt_cbc(
     const unsigned char * data,
     const unsigned long data_size,
-    const unsigned char * key,
-    const unsigned long key_size,
+    const KeySchedule & key_schedule,
     const unsigned char (* iv)[16],
     unsigned char * decrypted,
     const unsigned long decrypted_size,
     unsigned long * padded_size
     ) {
-    const Error e = detail::check_decrypt_cond(data_size, key_size, decrypted_size, padded_size);
+    const Error e = detail::check_decrypt_cond(data_size, key_schedule.key_size(), decrypted_size, padded_size);
     if (e != kErrorOk) {
         return e;
     }
 
-    const detail::RoundKeys rkeys = detail::expand_key(key, static_cast<int>(key_size));
+    const detail::RoundKeys & dkeys = key_schedule.decrypt_round_keys();
 
     // decrypt 1st state
-    detail::decrypt_state(rkeys, data, decrypted);
+    detail::decrypt_state(dkeys, data, decrypted);
     if (iv) {
         detail::xor_data(decrypted, *iv);
     }
 
     // decrypt mid
+    // Every block depends only on the ciphertext, so decrypt a batch at once and chain afterwards.
     const unsigned long bc = data_size / detail::kStateSize - 1;
-    for (unsigned long i = 1; i < bc; ++i) {
-        const long offset = i * detail::kStateSize;
-        detail::decrypt_state(rkeys, data + offset, decrypted + offset);
-        detail::xor_data(decrypted + offset, data + offset - detail::kStateSize);
+    for (unsigned long i = 1; i < bc; i += detail::kCbcBatchBlocks) {
+        const unsigned long n = (bc - i < detail::kCbcBatchBlocks) ? bc - i : detail::kCbcBatchBlocks;
+        const unsigned long offset = i * detail::kStateSize;
+        detail::decrypt_blocks(dkeys, data + offset, decrypted + offset, n);
+        detail::xor_bytes(decrypted + offset, data + offset - detail::kStateSize, n * detail::kStateSize);
     }
 
     // decrypt last
     unsigned char last[detail::kStateSize] = {};
     if (data_size > detail::kStateSize) {
-        detail::decrypt_state(rkeys, data + (bc * detail::kStateSize), last);
+        detail::decrypt_state(dkeys, data + (bc * detail::kStateSize), last);
         detail::xor_data(last, data + (bc * detail::kStateSize - detail::kStateSize));
     }
     else {
@@ -719,6 +3837,101 @@ inline Error decrypt_cbc(
     return kErrorOk;
 }
 
+/**
+ * Decrypt data with CBC mode.
+ * @param [in]  data Data bytes.
+ * @param [in]  data_size Data size.
+ * @param [in]  key Key bytes.
+ * @param [in]  key_size Key size.
+ * @param [in]  iv Initialize vector.
+ * @param [out] decrypted Decrypted data buffer.
+ * @param [in]  decrypted_size Decrypted data buffer size.
+ * @param [out] padded_size If this value is NULL, this function does not remove padding.
+ *  If this value is not NULL, this function removes padding by PKCS
+ *  and returns padded size using padded_size.
+ * @since 1.0.0
+ */
+inline Error decrypt_cbc(
+    const unsigned char * data,
+    const unsigned long data_size,
+    const unsigned char * key,
+    const unsigned long key_size,
+    const unsigned char (* iv)[16],
+    unsigned char * decrypted,
+    const unsigned long decrypted_size,
+    unsigned long * padded_size
+    ) {
+    KeySchedule key_schedule;
+    detail::expand_key_parts(key_schedule, key, key_size, detail::kKeyPartEncrypt | detail::kKeyPartDecrypt);
+    return decrypt_cbc(data, data_size, key_schedule, iv, decrypted, decrypted_size, padded_size);
+}
+
+/**
+ * @note
+ * This is BETA API. I might change API in the future.
+ *
+ * Encrypts or decrypt data in-place with CTR mode using an expanded key.
+ * @param [in,out]  data Data.
+ * @param [in,out]  data_size Data size.
+ * @param [in]  key_schedule Expanded key.
+ * @param [in]  nonce 16 bytes.
+ * @param [in]  offset Byte offset of data in the whole stream. The keystream starts at counter nonce + offset / 16.
+ * @since 1.0.0
+ */
+inline Error crypt_ctr(
+    unsigned char *data,
+    unsigned long data_size,
+    const KeySchedule &key_schedule,
+    const unsigned char *nonce,
+    const unsigned long nonce_size,
+    const uint64_t offset = 0
+) {
+    if (nonce_size > detail::kStateSize) return kErrorInvalidNonceSize;
+    if (!key_schedule.is_valid()) return kErrorInvalidKeySize;
+    const detail::RoundKeys &rkeys = key_schedule.round_keys();
+
+    unsigned char counter[detail::kStateSize] = {};
+    memcpy(counter, nonce, nonce_size);
+    detail::Counter c = detail::load_counter(counter);
+    detail::add_counter(c, offset / detail::kStateSize);
+
+    unsigned char counters[detail::kCtrBatchBlocks * detail::kStateSize];
+    unsigned char blk[detail::kCtrBatchBlocks * detail::kStateSize];
+
+    unsigned long pos = 0;
+
+    // partial first block
+    const unsigned long skip = static_cast<unsigned long>(offset % detail::kStateSize);
+    if (skip != 0 && data_size != 0) {
+        detail::make_counter_blocks(c, counters, 1);
+        detail::encrypt_blocks(rkeys, counters, blk, 1);
+        const unsigned long len = (data_size < detail::kStateSize - skip) ? data_size : detail::kStateSize - skip;
+        detail::xor_bytes(data, blk + skip, len);
+        pos = len;
+    }
+
+#if PLUSAES_HAS_VAES
+    if (detail::block_cipher().backend == kBackendVaes) {
+        pos += detail::vaes_crypt_ctr(rkeys, c, data + pos, data_size - pos);
+    }
+#endif
+
+    while (pos < data_size) {
+        // encrypt a batch of counter blocks at once
+        const unsigned long rem = data_size - pos;
+        const unsigned long rem_blocks = (rem + detail::kStateSize - 1) / detail::kStateSize;
+        const unsigned long n = (rem_blocks < detail::kCtrBatchBlocks) ? rem_blocks : detail::kCtrBatchBlocks;
+        detail::make_counter_blocks(c, counters, n);
+        detail::encrypt_blocks(rkeys, counters, blk, n);
+
+        const unsigned long len = (rem < n * detail::kStateSize) ? rem : n * detail::kStateSize;
+        detail::xor_bytes(data + pos, blk, len);
+        pos += len;
+    }
+
+    return kErrorOk;
+}
+
 /**
  * @note
  * This is BETA API. I might change API in the future.
@@ -729,6 +3942,7 @@ inline Error decrypt_cbc(
  * @param [in]  key key bytes. The key length must be 16 (128-bit), 24 (192-bit) or 32 (256-bit).
  * @param [in]  key_size key size.
  * @param [in]  nonce 16 bytes.
+ * @param [in]  offset Byte offset of data in the whole stream. The keystream starts at counter nonce + offset / 16.
  * @since 1.0.0
  */
 inline Error crypt_ctr(
@@ -737,30 +3951,512 @@ inline Error crypt_ctr(
     const unsigned char *key,
     const unsigned long key_size,
     const unsigned char *nonce,
-    const unsigned long nonce_size
+    const unsigned long nonce_size,
+    const uint64_t offset = 0
 ) {
     if (nonce_size > detail::kStateSize) return kErrorInvalidNonceSize;
-    if (!detail::is_valid_key_size(key_size)) return kErrorInvalidKeySize;
-    const detail::RoundKeys rkeys = detail::expand_key(key, static_cast<int>(key_size));
+    KeySchedule key_schedule;
+    detail::expand_key_parts(key_schedule, key, key_size, detail::kKeyPartEncrypt);
+    return crypt_ctr(data, data_size, key_schedule, nonce, nonce_size, offset);
+}
 
-    unsigned long pos = 0;
-    unsigned long blkpos = detail::kStateSize;
-    unsigned char blk[detail::kStateSize];
-    unsigned char counter[detail::kStateSize] = {};
-    memcpy(counter, nonce, nonce_size);
+/**
+ * Encrypts data in-place with GCM mode using an expanded key.
+ * @param [in,out]  data Data.
+ * @param [in]  data_size Data size. It must not exceed (2^32 - 2) * 16 bytes.
+ * @param [in]  aad Additional authenticated data. It can be NULL if aad_size is 0.
+ * @param [in]  aad_size Additional authenticated data size. It must not exceed 2^61 - 1 bytes.
+ * @param [in]  key_schedule Expanded key.
+ * @param [in]  iv Initialize vector. 12 bytes is recommended.
+ * @param [in]  iv_size Initialize vector size. It must not be 0.
+ * @param [out] tag Authentication tag.
+ * @param [in]  tag_size Tag size. It must be 4, 8 or 12 to 16.
+ * @since 1.0.0
+ */
+inline Error encrypt_gcm(
+    unsigned char * data,
+    const unsigned long data_size,
+    const unsigned char * aad,
+    const unsigned long aad_size,
+    const KeySchedule & key_schedule,
+    const unsigned char * iv,
+    const unsigned long iv_size,
+    unsigned char * tag,
+    const unsigned long tag_size
+    ) {
+    if (!key_schedule.is_valid()) return kErrorInvalidKeySize;
+    if (iv_size == 0) return kErrorInvalidIvSize;
+    if (!detail::is_valid_gcm_tag_size(tag_size)) return kErrorInvalidTagSize;
+    if (!detail::is_valid_gcm_data_size(data_size) || !detail::is_valid_gcm_aad_size(aad_size)) return kErrorInvalidDataSize;
 
-    while (pos < data_size) {
-        if (blkpos == detail::kStateSize) {
-            detail::encrypt_state(rkeys, counter, blk);
-            detail::incr_counter(counter);
-            blkpos = 0;
-        }
-        data[pos++] ^= blk[blkpos++];
+    unsigned char full_tag[detail::kGcmBlockSize];
+    detail::gcm_crypt(key_schedule.round_keys(), key_schedule.gcm_table(), data, data_size, aad, aad_size, iv, iv_size, true, full_tag);
+    memcpy(tag, full_tag, tag_size);
+
+    return kErrorOk;
+}
+
+/**
+ * Encrypts data in-place with GCM mode.
+ * @param [in,out]  data Data.
+ * @param [in]  data_size Data size. It must not exceed (2^32 - 2) * 16 bytes.
+ * @param [in]  aad Additional authenticated data. It can be NULL if aad_size is 0.
+ * @param [in]  aad_size Additional authenticated data size. It must not exceed 2^61 - 1 bytes.
+ * @param [in]  key Key bytes. The key length must be 16 (128-bit), 24 (192-bit) or 32 (256-bit).
+ * @param [in]  key_size Key size.
+ * @param [in]  iv Initialize vector. 12 bytes is recommended.
+ * @param [in]  iv_size Initialize vector size. It must not be 0.
+ * @param [out] tag Authentication tag.
+ * @param [in]  tag_size Tag size. It must be 4, 8 or 12 to 16.
+ * @since 1.0.0
+ */
+inline Error encrypt_gcm(
+    unsigned char * data,
+    const unsigned long data_size,
+    const unsigned char * aad,
+    const unsigned long aad_size,
+    const unsigned char * key,
+    const unsigned long key_size,
+    const unsigned char * iv,
+    const unsigned long iv_size,
+    unsigned char * tag,
+    const unsigned long tag_size
+    ) {
+    if (!detail::is_valid_gcm_data_size(data_size) || !detail::is_valid_gcm_aad_size(aad_size)) return kErrorInvalidDataSize;
+
+    KeySchedule key_schedule;
+    detail::expand_key_parts(key_schedule, key, key_size, detail::kKeyPartEncrypt | detail::kKeyPartGcm);
+    return encrypt_gcm(data, data_size, aad, aad_size, key_schedule, iv, iv_size, tag, tag_size);
+}
+
+/**
+ * Decrypts data in-place with GCM mode using an expanded key.
+ * If the tag does not match, data is cleared with zeros and kErrorInvalidTag is returned.
+ * @param [in,out]  data Data.
+ * @param [in]  data_size Data size. It must not exceed (2^32 - 2) * 16 bytes.
+ * @param [in]  aad Additional authenticated data. It can be NULL if aad_size is 0.
+ * @param [in]  aad_size Additional authenticated data size. It must not exceed 2^61 - 1 bytes.
+ * @param [in]  key_schedule Expanded key.
+ * @param [in]  iv Initialize vector.
+ * @param [in]  iv_size Initialize vector size. It must not be 0.
+ * @param [in]  tag Authentication tag.
+ * @param [in]  tag_size Tag size. It must be 4, 8 or 12 to 16.
+ * @since 1.0.0
+ */
+inline Error decrypt_gcm(
+    unsigned char * data,
+    const unsigned long data_size,
+    const unsigned char * aad,
+    const unsigned long aad_size,
+    const KeySchedule & key_schedule,
+    const unsigned char * iv,
+    const unsigned long iv_size,
+    const unsigned char * tag,
+    const unsigned long tag_size
+    ) {
+    if (!key_schedule.is_valid()) return kErrorInvalidKeySize;
+    if (iv_size == 0) return kErrorInvalidIvSize;
+    if (!detail::is_valid_gcm_tag_size(tag_size)) return kErrorInvalidTagSize;
+    if (!detail::is_valid_gcm_data_size(data_size) || !detail::is_valid_gcm_aad_size(aad_size)) return kErrorInvalidDataSize;
+
+    unsigned char full_tag[detail::kGcmBlockSize];
+    detail::gcm_crypt(key_schedule.round_keys(), key_schedule.gcm_table(), data, data_size, aad, aad_size, iv, iv_size, false, full_tag);
+
+    // compare in constant time
+    unsigned char diff = 0;
+    for (unsigned long i = 0; i < tag_size; ++i) {
+        diff |= full_tag[i] ^ tag[i];
+    }
+    if (diff != 0) {
+        if (data_size > 0) memset(data, 0, data_size);
+        return kErrorInvalidTag;
     }
 
     return kErrorOk;
 }
 
+/**
+ * Decrypts data in-place with GCM mode.
+ * If the tag does not match, data is cleared with zeros and kErrorInvalidTag is returned.
+ * @param [in,out]  data Data.
+ * @param [in]  data_size Data size. It must not exceed (2^32 - 2) * 16 bytes.
+ * @param [in]  aad Additional authenticated data. It can be NULL if aad_size is 0.
+ * @param [in]  aad_size Additional authenticated data size. It must not exceed 2^61 - 1 bytes.
+ * @param [in]  key Key bytes. The key length must be 16 (128-bit), 24 (192-bit) or 32 (256-bit).
+ * @param [in]  key_size Key size.
+ * @param [in]  iv Initialize vector.
+ * @param [in]  iv_size Initialize vector size. It must not be 0.
+ * @param [in]  tag Authentication tag.
+ * @param [in]  tag_size Tag size. It must be 4, 8 or 12 to 16.
+ * @since 1.0.0
+ */
+inline Error decrypt_gcm(
+    unsigned char * data,
+    const unsigned long data_size,
+    const unsigned char * aad,
+    const unsigned long aad_size,
+    const unsigned char * key,
+    const unsigned long key_size,
+    const unsigned char * iv,
+    const unsigned long iv_size,
+    const unsigned char * tag,
+    const unsigned long tag_size
+    ) {
+    if (!detail::is_valid_gcm_data_size(data_size) || !detail::is_valid_gcm_aad_size(aad_size)) return kErrorInvalidDataSize;
+
+    KeySchedule key_schedule;
+    detail::expand_key_parts(key_schedule, key, key_size, detail::kKeyPartEncrypt | detail::kKeyPartGcm);
+    return decrypt_gcm(data, data_size, aad, aad_size, key_schedule, iv, iv_size, tag, tag_size);
+}
+
+/**
+ * @note
+ * This is BETA API. I might change API in the future.
+ *
+ * CTR mode stream that encrypts or decrypts fragments of any size in order.
+ * Unused keystream bytes are kept for the next update().
+ * @since 1.0.0
+ */
+class CtrStream {
+public:
+    /**
+     * Creates a stream starting at counter = nonce.
+     * @param [in]  key_schedule Expanded key. It is copied.
+     * @param [in]  nonce 16 bytes.
+     * @param [in]  nonce_size Nonce size.
+     */
+    CtrStream(const KeySchedule & key_schedule, const unsigned char * nonce, const unsigned long nonce_size)
+        : key_schedule_(key_schedule), error_(kErrorOk), ks_pos_(0), ks_len_(0) {
+        init(nonce, nonce_size);
+    }
+
+    /**
+     * Creates a stream starting at counter = nonce.
+     * @param [in]  key Key bytes. The key length must be 16 (128-bit), 24 (192-bit) or 32 (256-bit).
+     * @param [in]  key_size Key size.
+     * @param [in]  nonce 16 bytes.
+     * @param [in]  nonce_size Nonce size.
+     */
+    CtrStream(const unsigned char * key, const unsigned long key_size, const unsigned char * nonce, const unsigned long nonce_size)
+        : error_(kErrorOk), ks_pos_(0), ks_len_(0) {
+        detail::expand_key_parts(key_schedule_, key, key_size, detail::kKeyPartEncrypt);
+        init(nonce, nonce_size);
+    }
+
+    /**
+     * Encrypts or decrypts the next fragment in-place.
+     * @param [in,out]  data Data.
+     * @param [in]  data_size Data size.
+     */
+    Error update(unsigned char * data, unsigned long data_size) {
+        if (error_ != kErrorOk) return error_;
+
+        while (data_size > 0) {
+            if (ks_pos_ == ks_len_) {
+                const unsigned long blocks = (data_size + detail::kStateSize - 1) / detail::kStateSize;
+                refill((blocks < detail::kCtrBatchBlocks) ? blocks : detail::kCtrBatchBlocks);
+            }
+
+            const unsigned long avail = ks_len_ - ks_pos_;
+            const unsigned long len = (data_size < avail) ? data_size : avail;
+            detail::xor_bytes(data, keystream_ + ks_pos_, len);
+            ks_pos_ += len;
+            data += len;
+            data_size -= len;
+        }
+
+        return kErrorOk;
+    }
+
+    /**
+     * Moves to a byte offset in the stream.
+     * @param [in]  offset Byte offset from the start (counter = nonce).
+     */
+    Error seek(const uint64_t offset) {
+        if (error_ != kErrorOk) return error_;
+
+        counter_ = nonce_;
+        detail::add_counter(counter_, offset / detail::kStateSize);
+        ks_pos_ = ks_len_ = 0;
+
+        const unsigned long skip = static_cast<unsigned long>(offset % detail::kStateSize);
+        if (skip != 0) {
+            refill(1);
+            ks_pos_ = skip;
+        }
+
+        return kErrorOk;
+    }
+
+private:
+    void init(const unsigned char * nonce, const unsigned long nonce_size) {
+        if (nonce_size > detail::kStateSize) {
+            error_ = kErrorInvalidNonceSize;
+            return;
+        }
+        if (!key_schedule_.is_valid()) {
+            error_ = kErrorInvalidKeySize;
+            return;
+        }
+
+        unsigned char counter[detail::kStateSize] = {};
+        memcpy(counter, nonce, nonce_size);
+        nonce_ = counter_ = detail::load_counter(counter);
+    }
+
+    void refill(const unsigned long blocks) {
+        unsigned char counters[sizeof(keystream_)];
+        detail::make_counter_blocks(counter_, counters, blocks);
+        detail::encrypt_blocks(key_schedule_.round_keys(), counters, keystream_, blocks);
+        ks_pos_ = 0;
+        ks_len_ = blocks * detail::kStateSize;
+    }
+
+    KeySchedule key_schedule_;
+    Error error_;
+    detail::Counter nonce_;
+    detail::Counter counter_;
+    unsigned char keystream_[detail::kCtrBatchBlocks * detail::kStateSize];
+    unsigned long ks_pos_;
+    unsigned long ks_len_;
+};
+
+namespace detail {
+
+/**
+ * Shared implementation of the streaming ECB/CBC encryptors and decryptors.
+ * Holds the chaining block and the pending input that does not fill a block yet.
+ */
+class BlockStream {
+public:
+    /**
+     * Processes the next fragment of data.
+     * Only whole blocks are written; the rest is kept until the next call.
+     * A decryptor with padding also holds back the last block for finalize().
+     * @param [in]  data Data.
+     * @param [in]  data_size Data size.
+     * @param [out] out Output buffer. It must not overlap data.
+     * @param [in]  out_size Output buffer size. It needs (pending + data_size) rounded down to 16 bytes.
+     * @param [out] out_written Written size. It can be NULL.
+     */
+    Error update(
+        const unsigned char * data,
+        unsigned long data_size,
+        unsigned char * out,
+        const unsigned long out_size,
+        unsigned long * out_written
+        ) {
+        if (out_written) *out_written = 0;
+        if (error_ != kErrorOk) return error_;
+
+        const unsigned long total = pending_size_ + data_size;
+        const unsigned long hold = (!encrypts_ && pads_) ? 1 : 0;
+        unsigned long blocks = (total >= hold) ? (total - hold) / kStateSize : 0;
+        if (out_size < blocks * kStateSize) {
+            return kErrorInvalidBufferSize;
+        }
+        if (out_written) *out_written = blocks * kStateSize;
+
+        // complete the pending block
+        if (blocks > 0 && pending_size_ > 0) {
+            const unsigned long n = kStateSize - pending_size_;
+            memcpy(pending_ + pending_size_, data, n);
+            data += n;
+            data_size -= n;
+            process(pending_, out, 1);
+            out += kStateSize;
+            pending_size_ = 0;
+            --blocks;
+        }
+
+        process(data, out, blocks);
+        data += blocks * kStateSize;
+        data_size -= blocks * kStateSize;
+
+        memcpy(pending_ + pending_size_, data, data_size);
+        pending_size_ += data_size;
+
+        return kErrorOk;
+    }
+
+    /**
+     * Processes the pending data.
+     * An encryptor with padding writes the last padded block (16 bytes).
+     * A decryptor with padding writes the last block without padding.
+     * Without padding, the total data size must have been multiple of 16.
+     * @param [out] out Output buffer.
+     * @param [in]  out_size Output buffer size.
+     * @param [out] out_written Written size. It can be NULL.
+     */
+    Error finalize(unsigned char * out, const unsigned long out_size, unsigned long * out_written) {
+        if (out_written) *out_written = 0;
+        if (error_ != kErrorOk) return error_;
+
+        if (!pads_) {
+            return (pending_size_ == 0) ? kErrorOk : kErrorInvalidDataSize;
+        }
+
+        unsigned char last[kStateSize];
+        if (encrypts_) {
+            if (out_size < kStateSize) {
+                return kErrorInvalidBufferSize;
+            }
+            memset(pending_ + pending_size_, static_cast<int>(kStateSize - pending_size_), kStateSize - pending_size_);
+            process(pending_, last, 1);
+            memcpy(out, last, kStateSize);
+            pending_size_ = 0;
+            if (out_written) *out_written = kStateSize;
+            return kErrorOk;
+        }
+
+        if (pending_size_ != kStateSize) {
+            return kErrorInvalidDataSize;
+        }
+        process(pending_, last, 1);
+        pending_size_ = 0;
+
+        const unsigned long padding = last[kStateSize - 1];
+        if (!check_padding(padding, last)) {
+            return kErrorInvalidKey;
+        }
+        const unsigned long cs = kStateSize - padding;
+        if (out_size < cs) {
+            return kErrorInvalidBufferSize;
+        }
+        memcpy(out, last, cs);
+        if (out_written) *out_written = cs;
+
+        return kErrorOk;
+    }
+
+protected:
+    BlockStream(
+        const KeySchedule & key_schedule,
+        const bool chains,
+        const unsigned char (* iv)[16],
+        const bool encrypts,
+        const bool pads
+        ) : key_schedule_(key_schedule), error_(kErrorOk), chains_(chains), encrypts_(encrypts), pads_(pads), pending_size_(0) {
+        if (!key_schedule_.is_valid()) {
+            error_ = kErrorInvalidKeySize;
+        }
+        memset(chain_, 0, sizeof(chain_));
+        if (iv) {
+            memcpy(chain_, *iv, sizeof(chain_));
+        }
+    }
+
+private:
+    void process(const unsigned char * in, unsigned char * out, const unsigned long blocks) {
+        if (blocks == 0) return;
+        const RoundKeys & rkeys = key_schedule_.round_keys();
+
+        if (!chains_) {
+            if (encrypts_) encrypt_blocks(rkeys, in, out, blocks);
+            else decrypt_blocks(key_schedule_.decrypt_round_keys(), in, out, blocks);
+            return;
+        }
+
+        if (encrypts_) {
+            for (unsigned long i = 0; i < blocks; ++i) {
+                unsigned char s[kStateSize];
+                memcpy(s, in + i * kStateSize, kStateSize);
+                xor_data(s, chain_);
+                encrypt_state(rkeys, s, chain_);
+                memcpy(out + i * kStateSize, chain_, kStateSize);
+            }
+            return;
+        }
+
+        decrypt_blocks(key_schedule_.decrypt_round_keys(), in, out, blocks);
+        xor_data(out, chain_);
+        xor_bytes(out + kStateSize, in, (blocks - 1) * kStateSize);
+        memcpy(chain_, in + (blocks - 1) * kStateSize, kStateSize);
+    }
+
+    KeySchedule key_schedule_;
+    Error error_;
+    bool chains_;
+    bool encrypts_;
+    bool pads_;
+    unsigned char chain_[kStateSize];
+    unsigned char pending_[kStateSize];
+    unsigned long pending_size_;
+};
+
+} // namespace detail
+
+/**
+ * @note
+ * This is BETA API. I might change API in the future.
+ *
+ * Encrypts data with ECB mode incrementally. See detail::BlockStream for update() and finalize().
+ * @since 1.0.0
+ */
+class EcbEncryptor : public detail::BlockStream {
+public:
+    /**
+     * @param [in]  key_schedule Expanded key. It is copied.
+     * @param [in]  pads If this value is true, finalize() pads data by PKCS.
+     */
+    EcbEncryptor(const KeySchedule & key_schedule, const bool pads)
+        : detail::BlockStream(key_schedule, false, NULL, true, pads) {}
+};
+
+/**
+ * @note
+ * This is BETA API. I might change API in the future.
+ *
+ * Decrypts data with ECB mode incrementally. See detail::BlockStream for update() and finalize().
+ * @since 1.0.0
+ */
+class EcbDecryptor : public detail::BlockStream {
+public:
+    /**
+     * @param [in]  key_schedule Expanded key. It is copied.
+     * @param [in]  pads If this value is true, finalize() removes padding by PKCS.
+     */
+    EcbDecryptor(const KeySchedule & key_schedule, const bool pads)
+        : detail::BlockStream(key_schedule, false, NULL, false, pads) {}
+};
+
+/**
+ * @note
+ * This is BETA API. I might change API in the future.
+ *
+ * Encrypts data with CBC mode incrementally. See detail::BlockStream for update() and finalize().
+ * @since 1.0.0
+ */
+class CbcEncryptor : public detail::BlockStream {
+public:
+    /**
+     * @param [in]  key_schedule Expanded key. It is copied.
+     * @param [in]  iv Initialize vector. NULL is all zero.
+     * @param [in]  pads If this value is true, finalize() pads data by PKCS.
+     */
+    CbcEncryptor(const KeySchedule & key_schedule, const unsigned char (* iv)[16], const bool pads)
+        : detail::BlockStream(key_schedule, true, iv, true, pads) {}
+};
+
+/**
+ * @note
+ * This is BETA API. I might change API in the future.
+ *
+ * Decrypts data with CBC mode incrementally. See detail::BlockStream for update() and finalize().
+ * Blocks passed in one update() are decrypted in a batch.
+ * @since 1.0.0
+ */
+class CbcDecryptor : public detail::BlockStream {
+public:
+    /**
+     * @param [in]  key_schedule Expanded key. It is copied.
+     * @param [in]  iv Initialize vector. NULL is all zero.
+     * @param [in]  pads If this value is true, finalize() removes padding by PKCS.
+     */
+    CbcDecryptor(const KeySchedule & key_schedule, const unsigned char (* iv)[16], const bool pads)
+        : detail::BlockStream(key_schedule, true, iv, false, pads) {}
+};
+
 } // namespace plusaes
 
 #endif // PLUSAES_HPP__
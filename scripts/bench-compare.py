@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""Compares two JSON result files of the bench program.
+
+    bench-compare.py BASELINE CURRENT [--threshold PERCENT]
+
+Matches the results by mode, operation, key size and message size, and the key
+setups by operation (a KeySchedule or a 16 B raw key call) and key size. Prints the change of each entry and exits with 1 if any of
+them is slower than the baseline by more than the threshold (default 5%).
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        return json.load(f)
+
+
+def setup_key(s):
+    # files without 'op' have only the KeySchedule setup
+    return (s.get('op', 'schedule'), s['key_bits'])
+
+
+def result_key(r):
+    return (r['mode'], r['op'], r['key_bits'], r['size'])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('baseline')
+    parser.add_argument('current')
+    parser.add_argument('--threshold', type=float, default=5.0, help='allowed slowdown in percent')
+    args = parser.parse_args()
+
+    base = load(args.baseline)
+    cur = load(args.current)
+    if base.get('backend') != cur.get('backend'):
+        print('warning: backend %s -> %s' % (base.get('backend'), cur.get('backend')))
+
+    # (name, slowdown in percent): positive is slower
+    rows = []
+    base_setup = dict((setup_key(s), s) for s in base.get('key_setup', []))
+    for s in cur.get('key_setup', []):
+        b = base_setup.get(setup_key(s))
+        if b:
+            rows.append(('key setup %d %s' % (s['key_bits'], setup_key(s)[0]), (s['ns'] / b['ns'] - 1) * 100))
+
+    base_results = dict((result_key(r), r) for r in base.get('results', []))
+    for r in cur.get('results', []):
+        b = base_results.get(result_key(r))
+        if b:
+            name = '%s %s %d %d' % result_key(r)
+            rows.append((name, (b['mb_per_s'] / r['mb_per_s'] - 1) * 100))
+
+    regressions = 0
+    for name, slowdown in rows:
+        mark = ''
+        if slowdown > args.threshold:
+            mark = '  REGRESSION'
+            regressions += 1
+        print('%-32s %+7.1f%%%s' % (name, slowdown, mark))
+
+    print('%d of %d entries are slower by more than %.1f%%' % (regressions, len(rows), args.threshold))
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
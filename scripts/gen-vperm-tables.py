@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+"""Generates the nibble tables of the vector permute rounds in plusaes.hpp.
+
+A byte x is split into coordinates over GF(16) (the subfield of GF(2^8)):
+x = i + k * V, and i and k become the high and low nibbles. The inverse is
+then computed with 16-entry tables only (M. Hamburg, "Accelerating AES with
+Vector Permute Instructions", CHES 2009):
+
+    j = i ^ k
+    io = j ^ inv[inv[i] ^ a_div[k]]
+    jo = i ^ inv[inv[j] ^ a_div[k]]
+    x^-1 = lo_tbl[io] ^ hi_tbl[jo]
+
+inv[0] and a_div[0] are 0x80 (infinity), which pshufb turns into zero.
+V and A are the first pair for which lo_tbl/hi_tbl exist.
+"""
+
+
+def gmul(a, b):
+    r = 0
+    while b:
+        if b & 1:
+            r ^= a
+        a <<= 1
+        if a & 0x100:
+            a ^= 0x11B
+        b >>= 1
+    return r
+
+
+MUL = [[gmul(a, b) for b in range(256)] for a in range(256)]
+INV = [0] * 256
+for a in range(1, 256):
+    INV[a] = next(b for b in range(1, 256) if MUL[a][b] == 1)
+
+# GF(16) inside GF(2^8) (y^16 = y) and a nibble encoding of it
+
+
+def frob16(y):
+    for _ in range(4):
+        y = MUL[y][y]
+    return y
+
+
+SUB = [y for y in range(256) if frob16(y) == y]
+assert len(SUB) == 16
+
+BASIS = []
+for y in SUB:
+    span = {0}
+    for b in BASIS:
+        span |= {s ^ b for s in span}
+    if y not in span:
+        BASIS.append(y)
+DEC = []
+for n in range(16):
+    e = 0
+    for b in range(4):
+        if n >> b & 1:
+            e ^= BASIS[b]
+    DEC.append(e)
+ENC = {e: n for n, e in enumerate(DEC)}
+INF = 0x80
+T_INV = [INF if n == 0 else ENC[INV[DEC[n]]] for n in range(16)]
+
+
+def pshufb(t, i):
+    return 0 if i & 0x80 else t[i & 15]
+
+
+def solve(v, a):
+    a_div = [INF if n == 0 else ENC[MUL[DEC[a]][INV[DEC[n]]]] for n in range(16)]
+    edges = {}
+    for i in range(16):
+        for k in range(16):
+            x = DEC[i] ^ MUL[DEC[k]][v]
+            j = i ^ k
+            ak = pshufb(a_div, k)
+            io = pshufb(T_INV, pshufb(T_INV, i) ^ ak) ^ j
+            jo = pshufb(T_INV, pshufb(T_INV, j) ^ ak) ^ i
+            nf = ('lo', io) if io < 0x80 else ('zero',)
+            ng = ('hi', jo) if jo < 0x80 else ('zero',)
+            edges.setdefault(nf, []).append((ng, INV[x]))
+            edges.setdefault(ng, []).append((nf, INV[x]))
+    val = {}
+    starts = ([('zero',)] if ('zero',) in edges else []) + list(edges)
+    for s in starts:
+        if s in val:
+            continue
+        val[s] = 0
+        stack = [s]
+        while stack:
+            n = stack.pop()
+            for m, x in edges[n]:
+                if m in val:
+                    if val[m] != val[n] ^ x:
+                        return None
+                else:
+                    val[m] = val[n] ^ x
+                    stack.append(m)
+    lo = [val.get(('lo', n), 0) for n in range(16)]
+    hi = [val.get(('hi', n), 0) for n in range(16)]
+    return a_div, lo, hi
+
+
+def find():
+    for v in range(256):
+        if v in SUB:
+            continue
+        for a in range(16):
+            r = solve(v, a)
+            if r:
+                return v, r
+
+
+V, (A_DIV, INV_LO, INV_HI) = find()
+
+
+def to_tower(x):
+    for i in range(16):
+        for k in range(16):
+            if DEC[i] ^ MUL[DEC[k]][V] == x:
+                return i << 4 | k
+
+
+def rotl8(x, n):
+    return ((x << n) | (x >> (8 - n))) & 0xFF
+
+
+def affine(x):  # linear part of the S-box affine transformation
+    return x ^ rotl8(x, 1) ^ rotl8(x, 2) ^ rotl8(x, 3) ^ rotl8(x, 4)
+
+
+AFF_INV = {affine(x): x for x in range(256)}
+
+
+def tower_dec(x):  # decryption state basis: tower coordinates of A^-1 * x
+    return to_tower(AFF_INV[x])
+
+
+def nibbles(f):
+    return [f(n) for n in range(16)], [f(n << 4) for n in range(16)]
+
+
+TABLES = [
+    ('kVpInv', 'GF(16) inverse (1/0 = 0x80)', [T_INV]),
+    ('kVpADiv', 'A / k (A / 0 = 0x80)', [A_DIV]),
+    ('kVpIpt', 'byte -> tower coordinates, by low and high nibble', nibbles(to_tower)),
+    ('kVpSb1', 'encryption: tower(affine(x^-1)) by io and jo', [[to_tower(affine(v)) for v in INV_LO], [to_tower(affine(v)) for v in INV_HI]]),
+    ('kVpSb2', 'encryption: tower(2 * affine(x^-1))', [[to_tower(MUL[2][affine(v)]) for v in INV_LO], [to_tower(MUL[2][affine(v)]) for v in INV_HI]]),
+    ('kVpSbo', 'last encryption round: affine(x^-1)', [[affine(v) for v in INV_LO], [affine(v) for v in INV_HI]]),
+    ('kVpDipt', 'byte -> decryption coordinates (tower of A^-1 * x)', nibbles(tower_dec)),
+]
+for c, name in ((9, '9'), (0xB, 'B'), (0xD, 'D'), (0xE, 'E')):
+    TABLES.append(('kVpDsb' + name, 'decryption: tower(A^-1 * %d * x^-1)' % c,
+                   [[tower_dec(MUL[c][v]) for v in INV_LO], [tower_dec(MUL[c][v]) for v in INV_HI]]))
+TABLES.append(('kVpDsbo', 'last decryption round: x^-1', [INV_LO, INV_HI]))
+
+print('// generated by scripts/gen-vperm-tables.py (V = 0x%02X, A = 0x%X)' % (V, A_DIV[1]))
+for name, comment, rows in TABLES:
+    print('// %s' % comment)
+    print('const unsigned char %s[%s] = {' % (name, '16' if len(rows) == 1 else '2][16'))
+    for row in rows:
+        body = ', '.join('0x%02X' % b for b in row)
+        print('    %s%s%s,' % ('{' if len(rows) > 1 else '', body, '}' if len(rows) > 1 else ''))
+    print('};')
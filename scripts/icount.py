@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""Instruction count regression benchmark under Valgrind Cachegrind or Callgrind.
+
+    icount.py --program PATH [--baseline FILE] [--update] [--threshold PERCENT]
+              [--backend NAME] [--tool cachegrind|callgrind] [--iterations N] [--case NAME ...]
+
+Runs each case of the bench_icount program (bench_icount --list) twice, with N and
+2N iterations, and takes the difference of the counts, so that the program start-up
+and the cold misses of the first iteration cancel out. The counts are deterministic
+for a given binary, so a change of a few percent is a real change.
+
+Reports instructions (Ir) and simulated D1 misses (D1mr + D1mw) per unit: per key
+setup for key_setup-*, per 16 bytes block otherwise. With --baseline, exits with 1
+if the baseline is missing, lacks a case, or any count exceeds it by more than the
+threshold (default 2%). --update writes the counts to the baseline file instead.
+
+The counts depend on the compiler, the flags and the backend, so the baseline is
+only comparable to builds with the same toolchain. The backend is fixed with
+PLUSAES_BACKEND (default ttable, which does not depend on the CPU features;
+Valgrind does not emulate AVX-512, so the VAES backend is never selected under it).
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+# counts within this much per unit are equal, for the D1 misses that are mostly 0
+ABS_TOLERANCE = 0.01
+
+
+def parse_counts(path):
+    """Returns {event: total} of a cachegrind.out or callgrind.out file."""
+    events = None
+    summary = None
+    with open(path) as f:
+        for line in f:
+            if line.startswith('events:'):
+                events = line.split()[1:]
+            elif line.startswith('summary:') or line.startswith('totals:'):
+                summary = [int(v) for v in line.split()[1:]]
+    if events is None or summary is None:
+        raise RuntimeError('no events or summary in %s' % path)
+    return dict(zip(events, summary))
+
+
+def run_case(args, case, iterations):
+    with tempfile.NamedTemporaryFile(prefix='icount-', suffix='.out', delete=False) as tmp:
+        out_path = tmp.name
+    try:
+        cmd = ['valgrind', '--tool=' + args.tool, '--cache-sim=yes']
+        if args.tool == 'cachegrind':
+            cmd.append('--cachegrind-out-file=' + out_path)
+        else:
+            cmd.append('--callgrind-out-file=' + out_path)
+        cmd += [args.program, case, str(iterations)]
+        env = dict(os.environ, PLUSAES_BACKEND=args.backend)
+        subprocess.run(cmd, env=env, check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        return parse_counts(out_path)
+    finally:
+        os.unlink(out_path)
+
+
+def measure(args, case, units):
+    n = args.iterations
+    c1 = run_case(args, case, n)
+    c2 = run_case(args, case, 2 * n)
+
+    def per_unit(*events):
+        return sum(c2.get(e, 0) - c1.get(e, 0) for e in events) / float(n * units)
+
+    return {'Ir': per_unit('Ir'), 'D1': per_unit('D1mr', 'D1mw')}
+
+
+def program_info(program, backend):
+    env = dict(os.environ, PLUSAES_BACKEND=backend)
+    out = subprocess.run([program, '--info'], env=env, check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+    return dict(line.split(' ', 1) for line in out.splitlines() if ' ' in line)
+
+
+def list_cases(program):
+    out = subprocess.run([program, '--list'], check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+    return [(name, int(units)) for name, units in (line.split() for line in out.splitlines())]
+
+
+def compare(base, cur, threshold):
+    regressions = 0
+    for case in sorted(cur):
+        b = base.get(case)
+        if not b:
+            print('%-20s not in the baseline, record it with --update' % case)
+            regressions += 1
+            continue
+        cols = []
+        for event in ('Ir', 'D1'):
+            bv, cv = b[event], cur[case][event]
+            change = (cv / bv - 1) * 100 if bv else 0.0
+            bad = cv - bv > ABS_TOLERANCE and cv > bv * (1 + threshold / 100.0)
+            regressions += bad
+            cols.append('%s %10.3f -> %10.3f (%+6.2f%%)%s' % (event, bv, cv, change, ' REGRESSION' if bad else ''))
+        print('%-20s %s' % (case, '  '.join(cols)))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--program', required=True, help='path of bench_icount')
+    parser.add_argument('--baseline', help='baseline JSON file')
+    parser.add_argument('--update', action='store_true', help='write the counts to the baseline file')
+    parser.add_argument('--threshold', type=float, default=2.0, help='allowed increase in percent')
+    parser.add_argument('--backend', default='ttable')
+    parser.add_argument('--tool', choices=('cachegrind', 'callgrind'), default='cachegrind')
+    parser.add_argument('--iterations', type=int, default=20)
+    parser.add_argument('--case', action='append', help='run only these cases')
+    args = parser.parse_args()
+
+    info = program_info(args.program, args.backend)
+    cases = [(c, u) for c, u in list_cases(args.program) if not args.case or c in args.case]
+    counts = {}
+    for case, units in cases:
+        counts[case] = measure(args, case, units)
+        print('%-20s Ir %10.2f  D1 %8.3f' % (case, counts[case]['Ir'], counts[case]['D1']))
+        sys.stdout.flush()
+
+    result = {
+        'tool': args.tool,
+        'backend': args.backend,
+        'compiler': info.get('compiler', ''),
+        'version': info.get('version', ''),
+        'cases': counts,
+    }
+    if args.update:
+        if not args.baseline:
+            parser.error('--update needs --baseline')
+        with open(args.baseline, 'w') as f:
+            json.dump(result, f, indent=2, sort_keys=True)
+            f.write('\n')
+        print('wrote %s' % args.baseline)
+        return 0
+    if not args.baseline:
+        return 0
+    if not os.path.exists(args.baseline):
+        print('no baseline %s, create it with --update' % args.baseline)
+        return 1
+
+    with open(args.baseline) as f:
+        base = json.load(f)
+    for key in ('tool', 'backend', 'compiler'):
+        if base.get(key) != result[key]:
+            print('warning: %s %r in the baseline, %r now' % (key, base.get(key), result[key]))
+    regressions = compare(base['cases'], counts, args.threshold)
+    print('%d counts are missing or exceed the baseline by more than %.1f%%' % (regressions, args.threshold))
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,80 @@
+// Replaces the global operator new/delete to count allocations.
+// Kept apart from the tests, so that the compiler does not inline these into the
+// new/delete expressions of gtest and check malloc/free against operator new/delete.
+#include "alloc-count.hpp"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+bool g_counting = false;
+unsigned long g_allocations = 0;
+
+void* allocate(std::size_t size) {
+    if (g_counting) {
+        ++g_allocations;
+    }
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        // built without exceptions, so there is no std::bad_alloc to throw
+        std::abort();
+    }
+    return p;
+}
+
+} // no namespace
+
+namespace alloc_count {
+
+void start() {
+    g_allocations = 0;
+    g_counting = true;
+}
+
+unsigned long stop() {
+    g_counting = false;
+    return g_allocations;
+}
+
+} // namespace alloc_count
+
+void* operator new(std::size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size) {
+    return allocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
@@ -0,0 +1,15 @@
+#ifndef PLUSAES_UNIT_TEST_ALLOC_COUNT_HPP__
+#define PLUSAES_UNIT_TEST_ALLOC_COUNT_HPP__
+
+// Counts the calls of the global operator new of the test binary that links alloc-count.cpp.
+namespace alloc_count {
+
+/** Starts counting from 0. */
+void start();
+
+/** Stops counting and returns the number of allocations since start(). */
+unsigned long stop();
+
+} // namespace alloc_count
+
+#endif // PLUSAES_UNIT_TEST_ALLOC_COUNT_HPP__
@@ -22,6 +22,30 @@ void test_encrypt_decrypt_ctr(const std::string& data, const std::vector<unsigne
     EXPECT_EQ(s, data);
 }
 
+void test_ctr_by_block(const plusaes::KeySchedule& key_schedule, const unsigned char nonce[16], unsigned long size) {
+    std::vector<unsigned char> data(size + 1);
+    for (unsigned long i = 0; i < size; ++i) {
+        data[i] = (unsigned char)i;
+    }
+
+    // keystream by one block
+    std::vector<unsigned char> ok_crypted(data);
+    unsigned char counter[16];
+    memcpy(counter, nonce, sizeof(counter));
+    for (unsigned long i = 0; i < size; i += 16) {
+        unsigned char blk[16];
+        plusaes::detail::encrypt_state(key_schedule.round_keys(), counter, blk);
+        plusaes::detail::incr_counter(counter);
+        for (unsigned long j = 0; j < 16 && i + j < size; ++j) {
+            ok_crypted[i + j] ^= blk[j];
+        }
+    }
+
+    std::vector<unsigned char> crypted(data);
+    EXPECT_EQ(plusaes::crypt_ctr(&crypted[0], size, key_schedule, nonce, 16), plusaes::kErrorOk);
+    EXPECT_EQ(crypted, ok_crypted);
+}
+
 } // no namespace
 
 TEST(CTR, encrypt_decript) {
@@ -36,3 +60,134 @@ TEST(CTR, encrypt_decript) {
 
     test_encrypt_decrypt_ctr(data, key, nonce, ok_encrypted);
 }
+
+TEST(CTR, key_schedule) {
+    const std::string data = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    const auto key = plusaes::key_from_string(&"1234567890ABCDEF");
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+    const unsigned short nonce = 0;
+
+    const unsigned char ok_encrypted[] = {
+        0xfb, 0x48, 0x54, 0x65, 0x23, 0x91, 0x39, 0x77, 0x1b, 0x46, 0x2c, 0x01, 0xf8, 0x7a, 0x46, 0x22,
+        0x8a, 0xb6, 0x48, 0x19, 0x7d, 0xff, 0xfd, 0x1f, 0xec, 0x43
+    };
+
+    std::vector<unsigned char> crypted(data.begin(), data.end());
+    EXPECT_EQ(plusaes::crypt_ctr(&crypted[0], crypted.size(), key_schedule, (unsigned char*)&nonce, sizeof(nonce)), plusaes::kErrorOk);
+    EXPECT_EQ(memcmp(&crypted[0], ok_encrypted, crypted.size()), 0);
+
+    const plusaes::KeySchedule invalid;
+    EXPECT_EQ(plusaes::crypt_ctr(&crypted[0], crypted.size(), invalid, (unsigned char*)&nonce, sizeof(nonce)), plusaes::kErrorInvalidKeySize);
+}
+
+TEST(CTR, multi_block) {
+    const auto key = plusaes::key_from_string(&"1234567890ABCDEF1234567890ABCDEF");
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+    const unsigned char nonce[16] = {
+        0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xff, 0xfb};
+
+    for (unsigned long size = 0; size < 300; size += 7) {
+        test_ctr_by_block(key_schedule, nonce, size);
+    }
+}
+
+TEST(CTR, long_data) {
+    const auto key = plusaes::key_from_string(&"1234567890ABCDEF12345678");
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+    const unsigned char nonce[16] = {
+        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xe0};
+
+    // wider than the batches of the multi-block kernels, across the carry into the high 64 bits
+    for (unsigned long size = 0; size < 80 * 16; size += 16 * 7 + 3) {
+        test_ctr_by_block(key_schedule, nonce, size);
+    }
+}
+
+TEST(CTR, counter_carry) {
+    const auto key = plusaes::key_from_string(&"1234567890ABCDEF");
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+
+    // carry from the low 64 bits into the high 64 bits
+    const unsigned char nonce_64[16] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfd};
+    test_ctr_by_block(key_schedule, nonce_64, 200);
+
+    // wrap around 128 bits
+    const unsigned char nonce_128[16] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe};
+    test_ctr_by_block(key_schedule, nonce_128, 200);
+}
+
+TEST(CTR, offset) {
+    const auto key = plusaes::key_from_string(&"1234567890ABCDEF");
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+    const unsigned char nonce[16] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf0};
+
+    std::vector<unsigned char> data(600);
+    for (unsigned long i = 0; i < data.size(); ++i) {
+        data[i] = (unsigned char)i;
+    }
+
+    std::vector<unsigned char> ok_crypted(data);
+    EXPECT_EQ(plusaes::crypt_ctr(&ok_crypted[0], ok_crypted.size(), key_schedule, nonce, sizeof(nonce)), plusaes::kErrorOk);
+
+    // crypt a range [off, off + len) without the preceding data
+    for (unsigned long off = 0; off < 300; off += 13) {
+        for (unsigned long len = 0; len < 300; len += 29) {
+            std::vector<unsigned char> crypted(data.begin() + off, data.begin() + off + len + 1);
+            EXPECT_EQ(plusaes::crypt_ctr(&crypted[0], len, key_schedule, nonce, sizeof(nonce), off), plusaes::kErrorOk);
+            EXPECT_EQ(memcmp(&crypted[0], &ok_crypted[off], len), 0);
+            EXPECT_EQ(crypted[len], data[off + len]);
+        }
+    }
+
+    std::vector<unsigned char> crypted(data.begin() + 100, data.end());
+    EXPECT_EQ(plusaes::crypt_ctr(&crypted[0], crypted.size(), &key[0], (unsigned long)key.size(), nonce, sizeof(nonce), 100), plusaes::kErrorOk);
+    EXPECT_EQ(memcmp(&crypted[0], &ok_crypted[100], crypted.size()), 0);
+}
+
+TEST(CTR, stream) {
+    const auto key = plusaes::key_from_string(&"1234567890ABCDEF");
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+    const unsigned char nonce[16] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf0};
+
+    std::vector<unsigned char> data(1000);
+    for (unsigned long i = 0; i < data.size(); ++i) {
+        data[i] = (unsigned char)i;
+    }
+
+    std::vector<unsigned char> ok_crypted(data);
+    EXPECT_EQ(plusaes::crypt_ctr(&ok_crypted[0], ok_crypted.size(), key_schedule, nonce, sizeof(nonce)), plusaes::kErrorOk);
+
+    // fragments of various sizes
+    const unsigned long fragments[] = {0, 1, 15, 16, 17, 3, 130, 5, 128, 0, 250, 7};
+    plusaes::CtrStream stream(key_schedule, nonce, sizeof(nonce));
+    std::vector<unsigned char> crypted(data);
+    unsigned long pos = 0;
+    for (unsigned long i = 0; pos < crypted.size(); ++i) {
+        const unsigned long n = std::min(fragments[i % (sizeof(fragments) / sizeof(fragments[0]))], (unsigned long)crypted.size() - pos);
+        EXPECT_EQ(stream.update(&crypted[pos], n), plusaes::kErrorOk);
+        pos += n;
+    }
+    EXPECT_EQ(crypted, ok_crypted);
+
+    // seek
+    plusaes::CtrStream stream2(&key[0], (unsigned long)key.size(), nonce, sizeof(nonce));
+    for (unsigned long off = 0; off < 500; off += 37) {
+        std::vector<unsigned char> part(data.begin() + off, data.begin() + off + 100);
+        EXPECT_EQ(stream2.seek(off), plusaes::kErrorOk);
+        EXPECT_EQ(stream2.update(&part[0], 60), plusaes::kErrorOk);
+        EXPECT_EQ(stream2.update(&part[60], 40), plusaes::kErrorOk);
+        EXPECT_EQ(memcmp(&part[0], &ok_crypted[off], part.size()), 0);
+    }
+
+    // invalid
+    unsigned char b = 0;
+    plusaes::CtrStream invalid_key(plusaes::KeySchedule(), nonce, sizeof(nonce));
+    EXPECT_EQ(invalid_key.update(&b, 1), plusaes::kErrorInvalidKeySize);
+    plusaes::CtrStream invalid_nonce(key_schedule, nonce, 17);
+    EXPECT_EQ(invalid_nonce.update(&b, 1), plusaes::kErrorInvalidNonceSize);
+    EXPECT_EQ(invalid_nonce.seek(0), plusaes::kErrorInvalidNonceSize);
+}
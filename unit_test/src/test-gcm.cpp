@@ -0,0 +1,181 @@
+#include "gtest/gtest.h"
+
+#include "plusaes/plusaes.hpp"
+
+namespace {
+
+std::vector<unsigned char> from_hex(const std::string& hex) {
+    std::vector<unsigned char> bytes;
+    for (std::size_t i = 0; i + 1 < hex.size(); i += 2) {
+        bytes.push_back((unsigned char)std::stoi(hex.substr(i, 2), nullptr, 16));
+    }
+    return bytes;
+}
+
+void test_encrypt_decrypt_gcm(const std::string& key_hex, const std::string& iv_hex, const std::string& aad_hex,
+    const std::string& data_hex, const std::string& ok_encrypted_hex, const std::string& ok_tag_hex) {
+
+    const auto key = from_hex(key_hex);
+    const auto iv = from_hex(iv_hex);
+    const auto aad = from_hex(aad_hex);
+    const auto data = from_hex(data_hex);
+    const auto ok_encrypted = from_hex(ok_encrypted_hex);
+    const auto ok_tag = from_hex(ok_tag_hex);
+
+    // encrypt
+    std::vector<unsigned char> crypted(data);
+    crypted.push_back(0);
+    unsigned char tag[16] = {};
+    EXPECT_EQ(plusaes::encrypt_gcm(&crypted[0], (unsigned long)data.size(), aad.data(), (unsigned long)aad.size(),
+        &key[0], (unsigned long)key.size(), &iv[0], (unsigned long)iv.size(), tag, sizeof(tag)), plusaes::kErrorOk);
+    EXPECT_EQ(std::vector<unsigned char>(crypted.begin(), crypted.end() - 1), ok_encrypted);
+    EXPECT_EQ(std::vector<unsigned char>(tag, tag + sizeof(tag)), ok_tag);
+
+    // decrypt
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+    EXPECT_EQ(plusaes::decrypt_gcm(&crypted[0], (unsigned long)data.size(), aad.data(), (unsigned long)aad.size(),
+        key_schedule, &iv[0], (unsigned long)iv.size(), tag, sizeof(tag)), plusaes::kErrorOk);
+    EXPECT_EQ(std::vector<unsigned char>(crypted.begin(), crypted.end() - 1), data);
+    EXPECT_EQ(crypted.back(), 0);
+
+    // truncated tag
+    EXPECT_EQ(plusaes::encrypt_gcm(&crypted[0], (unsigned long)data.size(), aad.data(), (unsigned long)aad.size(),
+        key_schedule, &iv[0], (unsigned long)iv.size(), tag, 12), plusaes::kErrorOk);
+    EXPECT_EQ(plusaes::decrypt_gcm(&crypted[0], (unsigned long)data.size(), aad.data(), (unsigned long)aad.size(),
+        key_schedule, &iv[0], (unsigned long)iv.size(), tag, 12), plusaes::kErrorOk);
+    EXPECT_EQ(std::vector<unsigned char>(crypted.begin(), crypted.end() - 1), data);
+}
+
+} // no namespace
+
+// Test cases from "The Galois/Counter Mode of Operation (GCM)"
+
+TEST(GCM, test_case_2) {
+    test_encrypt_decrypt_gcm(
+        "00000000000000000000000000000000",
+        "000000000000000000000000",
+        "",
+        "00000000000000000000000000000000",
+        "0388dace60b6a392f328c2b971b2fe78",
+        "ab6e47d42cec13bdf53a67b21257bddf");
+}
+
+TEST(GCM, test_case_4) {
+    test_encrypt_decrypt_gcm(
+        "feffe9928665731c6d6a8f9467308308",
+        "cafebabefacedbaddecaf888",
+        "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+        "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+        "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+        "5bc94fbc3221a5db94fae95ae7121a47");
+}
+
+TEST(GCM, test_case_5) {
+    test_encrypt_decrypt_gcm(
+        "feffe9928665731c6d6a8f9467308308",
+        "cafebabefacedbad",
+        "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+        "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+        "61353b4c2806934a777ff51fa22a4755699b2a714fcdc6f83766e5f97b6c742373806900e49f24b22b097544d4896b424989b5e1ebac0f07c23f4598",
+        "3612d2e79e3b0785561be14aaca2fccb");
+}
+
+TEST(GCM, test_case_16) {
+    test_encrypt_decrypt_gcm(
+        "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308",
+        "cafebabefacedbaddecaf888",
+        "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+        "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+        "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+        "76fc6ece0f4e1768cddf8853bb2d551b");
+}
+
+// Several batches of blocks, checked by the tag over the ciphertext
+TEST(GCM, large) {
+    struct {
+        const char *key_hex;
+        const char *iv_hex;
+        unsigned long aad_size;
+        unsigned long data_size;
+        const char *ok_tag_hex;
+    } const cases[] = {
+        {"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", 20, 1000, "38da2454a01e1a610530fdb5dddddee5"},
+        {"feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", "cafebabefacedbad", 33, 4099, "3361cc468b2d1b903910fe83350c6282"},
+    };
+
+    for (const auto& c : cases) {
+        const auto key = from_hex(c.key_hex);
+        const auto iv = from_hex(c.iv_hex);
+        const auto ok_tag = from_hex(c.ok_tag_hex);
+        const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+
+        std::vector<unsigned char> aad(c.aad_size), data(c.data_size);
+        for (unsigned long i = 0; i < aad.size(); ++i) aad[i] = (unsigned char)i;
+        for (unsigned long i = 0; i < data.size(); ++i) data[i] = (unsigned char)i;
+
+        std::vector<unsigned char> crypted(data);
+        unsigned char tag[16] = {};
+        EXPECT_EQ(plusaes::encrypt_gcm(&crypted[0], (unsigned long)crypted.size(), &aad[0], (unsigned long)aad.size(),
+            key_schedule, &iv[0], (unsigned long)iv.size(), tag, sizeof(tag)), plusaes::kErrorOk);
+        EXPECT_EQ(std::vector<unsigned char>(tag, tag + sizeof(tag)), ok_tag);
+
+        EXPECT_EQ(plusaes::decrypt_gcm(&crypted[0], (unsigned long)crypted.size(), &aad[0], (unsigned long)aad.size(),
+            key_schedule, &iv[0], (unsigned long)iv.size(), tag, sizeof(tag)), plusaes::kErrorOk);
+        EXPECT_EQ(crypted, data);
+    }
+}
+
+TEST(GCM, invalid) {
+    const auto key = plusaes::key_from_string(&"1234567890ABCDEF");
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+    const unsigned char iv[12] = {};
+    unsigned char data[40] = {};
+    unsigned char tag[16] = {};
+
+    EXPECT_EQ(plusaes::encrypt_gcm(data, sizeof(data), nullptr, 0, plusaes::KeySchedule(), iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorInvalidKeySize);
+    EXPECT_EQ(plusaes::encrypt_gcm(data, sizeof(data), nullptr, 0, key_schedule, iv, 0, tag, sizeof(tag)), plusaes::kErrorInvalidIvSize);
+    EXPECT_EQ(plusaes::encrypt_gcm(data, sizeof(data), nullptr, 0, key_schedule, iv, sizeof(iv), tag, 11), plusaes::kErrorInvalidTagSize);
+    EXPECT_EQ(plusaes::decrypt_gcm(data, sizeof(data), nullptr, 0, key_schedule, iv, sizeof(iv), tag, 17), plusaes::kErrorInvalidTagSize);
+
+    // tampered data is cleared
+    EXPECT_EQ(plusaes::encrypt_gcm(data, sizeof(data), nullptr, 0, key_schedule, iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorOk);
+    data[5] ^= 1;
+    EXPECT_EQ(plusaes::decrypt_gcm(data, sizeof(data), nullptr, 0, key_schedule, iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorInvalidTag);
+    const unsigned char zero[sizeof(data)] = {};
+    EXPECT_EQ(memcmp(data, zero, sizeof(data)), 0);
+
+    // tampered aad
+    const unsigned char aad[3] = {1, 2, 3};
+    EXPECT_EQ(plusaes::encrypt_gcm(data, sizeof(data), aad, sizeof(aad), key_schedule, iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorOk);
+    EXPECT_EQ(plusaes::decrypt_gcm(data, sizeof(data), aad, 2, key_schedule, iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorInvalidTag);
+}
+
+TEST(GCM, invalid_size) {
+    if (sizeof(unsigned long) < 8) {
+        return; // the limits are not reachable with a 32-bit unsigned long
+    }
+
+    const auto key = plusaes::key_from_string(&"1234567890ABCDEF");
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+    const unsigned char iv[12] = {};
+    unsigned char data[16] = {};
+    unsigned char tag[16] = {};
+
+    // more than 2^32 - 2 blocks wraps the 32-bit counter back to J0
+    const unsigned long max_data_size = (unsigned long)(0xFFFFFFFEull * 16);
+    EXPECT_EQ(plusaes::encrypt_gcm(data, max_data_size + 1, nullptr, 0, key_schedule, iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorInvalidDataSize);
+    EXPECT_EQ(plusaes::decrypt_gcm(data, max_data_size + 1, nullptr, 0, key_schedule, iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorInvalidDataSize);
+    EXPECT_EQ(plusaes::encrypt_gcm(data, max_data_size + 1, nullptr, 0, &key[0], (unsigned long)key.size(), iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorInvalidDataSize);
+    EXPECT_EQ(plusaes::decrypt_gcm(data, max_data_size + 1, nullptr, 0, &key[0], (unsigned long)key.size(), iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorInvalidDataSize);
+
+    // the aad bit length must fit in 64 bits
+    const unsigned long max_aad_size = (unsigned long)(~0ull >> 3);
+    EXPECT_EQ(plusaes::encrypt_gcm(data, sizeof(data), data, max_aad_size + 1, key_schedule, iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorInvalidDataSize);
+    EXPECT_EQ(plusaes::decrypt_gcm(data, sizeof(data), data, max_aad_size + 1, key_schedule, iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorInvalidDataSize);
+    EXPECT_EQ(plusaes::encrypt_gcm(data, sizeof(data), data, max_aad_size + 1, &key[0], (unsigned long)key.size(), iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorInvalidDataSize);
+    EXPECT_EQ(plusaes::decrypt_gcm(data, sizeof(data), data, max_aad_size + 1, &key[0], (unsigned long)key.size(), iv, sizeof(iv), tag, sizeof(tag)), plusaes::kErrorInvalidDataSize);
+
+    // the data is left untouched
+    const unsigned char zero[sizeof(data)] = {};
+    EXPECT_EQ(memcmp(data, zero, sizeof(data)), 0);
+}
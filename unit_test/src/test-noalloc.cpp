@@ -0,0 +1,57 @@
+#include "gtest/gtest.h"
+
+#include "alloc-count.hpp"
+#include "plusaes/plusaes.hpp"
+
+// This binary is built with -fno-exceptions and PLUSAES_NO_EXCEPTIONS.
+#if !PLUSAES_NO_EXCEPTIONS
+#error "test-noalloc.cpp needs PLUSAES_NO_EXCEPTIONS"
+#endif
+
+TEST(NoAlloc, public_api) {
+    const unsigned char key[32] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    const unsigned char iv[16] = {9, 8, 7};
+    const unsigned char aad[20] = {5};
+    unsigned char data[100] = {1, 2, 3};
+    unsigned char encrypted[112] = {};
+    unsigned char decrypted[112] = {};
+    unsigned char tag[16] = {};
+    unsigned long padded = 0, written = 0;
+    plusaes::Error e[32] = {};
+    int n = 0;
+
+    alloc_count::start();
+    {
+        const plusaes::KeySchedule key_schedule(key, sizeof(key));
+        const plusaes::KeySchedule invalid(key, 15);
+
+        e[n++] = plusaes::encrypt_ecb(data, sizeof(data), key, 16, encrypted, sizeof(encrypted), true);
+        e[n++] = plusaes::decrypt_ecb(encrypted, sizeof(encrypted), key, 16, decrypted, sizeof(decrypted), &padded);
+        e[n++] = plusaes::encrypt_cbc(data, sizeof(data), key_schedule, &iv, encrypted, sizeof(encrypted), true);
+        e[n++] = plusaes::decrypt_cbc(encrypted, sizeof(encrypted), key_schedule, &iv, decrypted, sizeof(decrypted), &padded);
+        e[n++] = plusaes::encrypt_cbc(data, sizeof(data), key, 24, &iv, encrypted, sizeof(encrypted), true);
+        e[n++] = plusaes::crypt_ctr(data, sizeof(data), key, 32, iv, sizeof(iv), 5);
+        e[n++] = plusaes::encrypt_gcm(data, sizeof(data), aad, sizeof(aad), key_schedule, iv, 12, tag, sizeof(tag));
+        e[n++] = plusaes::decrypt_gcm(data, sizeof(data), aad, sizeof(aad), key, 32, iv, 12, tag, sizeof(tag));
+
+        plusaes::CtrStream ctr(key_schedule, iv, sizeof(iv));
+        e[n++] = ctr.update(data, 37);
+        e[n++] = ctr.seek(3);
+
+        plusaes::CbcEncryptor enc(key_schedule, &iv, true);
+        e[n++] = enc.update(data, 50, encrypted, sizeof(encrypted), &written);
+        e[n++] = enc.finalize(encrypted + written, sizeof(encrypted) - written, &written);
+
+        // errors are reported without throwing
+        e[n++] = plusaes::encrypt_ecb(data, sizeof(data), invalid, encrypted, sizeof(encrypted), true);
+        e[n++] = plusaes::decrypt_cbc(encrypted, sizeof(encrypted), key, 15, &iv, decrypted, sizeof(decrypted), &padded);
+    }
+    const unsigned long allocations = alloc_count::stop();
+
+    EXPECT_EQ(allocations, 0UL);
+    for (int i = 0; i < n - 2; ++i) {
+        EXPECT_EQ(e[i], plusaes::kErrorOk) << i;
+    }
+    EXPECT_EQ(e[n - 2], plusaes::kErrorInvalidKeySize);
+    EXPECT_EQ(e[n - 1], plusaes::kErrorInvalidKeySize);
+}
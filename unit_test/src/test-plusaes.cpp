@@ -1,6 +1,10 @@
 #include "gtest/gtest.h"
 #include "plusaes/plusaes.hpp"
 #include <fstream>
+#if __cplusplus >= 201103L
+#include <atomic>
+#include <thread>
+#endif
 
 using namespace plusaes::detail;
 
@@ -73,6 +77,24 @@ void test_encrypt_decrypt_cbc(const std::string & data, const std::vector<unsign
     }
 }
 
+// Feeds data to a stream in fragments of various sizes.
+std::vector<unsigned char> run_block_stream(plusaes::detail::BlockStream & stream, const std::vector<unsigned char> & data,
+    plusaes::Error * finalize_error) {
+
+    static const unsigned long fragments[] = {1, 0, 15, 16, 17, 3, 130, 5, 32, 64};
+    std::vector<unsigned char> out(data.size() + 16);
+    unsigned long pos = 0, out_pos = 0, written = 0;
+    for (unsigned long i = 0; pos < data.size(); ++i) {
+        const unsigned long n = std::min(fragments[i % (sizeof(fragments) / sizeof(fragments[0]))], (unsigned long)data.size() - pos);
+        EXPECT_EQ(stream.update(&data[0] + pos, n, &out[0] + out_pos, (unsigned long)out.size() - out_pos, &written), plusaes::kErrorOk);
+        pos += n;
+        out_pos += written;
+    }
+    *finalize_error = stream.finalize(&out[0] + out_pos, (unsigned long)out.size() - out_pos, &written);
+    out.resize(out_pos + written);
+    return out;
+}
+
 } // no namespace
 
 TEST(AES, version) {
@@ -226,6 +248,391 @@ TEST(AES, expand_key_256) {
     }
 }
 
+TEST(AES, round_keys_storage) {
+    const unsigned char key[32] = {};
+    const RoundKeys keys = expand_key(key, sizeof(key));
+    ASSERT_EQ(keys.size(), 15U);
+    ASSERT_EQ(get_rounds(keys), 14);
+    ASSERT_EQ(reinterpret_cast<std::size_t>(&keys[0]) % 16, 0U);
+
+    RoundKeys copied = keys;
+    ASSERT_EQ(memcmp(&copied[0], &keys[0], keys.size() * sizeof(RoundKey)), 0);
+    copied.clear();
+    ASSERT_EQ(copied.size(), 1U);
+}
+
+TEST(AES, expand_decrypt_key) {
+    unsigned char key[32] = {};
+    unsigned char data[16] = {};
+    for (int i = 0; i < 32; ++i) {
+        key[i] = (unsigned char)(i * 5 + 9);
+    }
+
+    const int key_sizes[] = {16, 24, 32};
+    for (int k = 0; k < 3; ++k) {
+        const RoundKeys keys = expand_key(key, key_sizes[k]);
+        const RoundKeys dkeys = expand_decrypt_key(keys);
+        ASSERT_EQ(dkeys.size(), keys.size());
+        ASSERT_EQ(memcmp(&dkeys.front(), &keys.front(), sizeof(State)), 0);
+        ASSERT_EQ(memcmp(&dkeys.back(), &keys.back(), sizeof(State)), 0);
+        for (std::size_t i = 1; i + 1 < keys.size(); ++i) {
+            State ok = keys[i];
+            inv_mix_columns(ok);
+            ASSERT_EQ(memcmp(&dkeys[i], &ok, sizeof(State)), 0);
+        }
+
+        // equivalent inverse cipher
+        unsigned char encrypted[16], decrypted[16];
+        encrypt_state_ref(keys, data, encrypted);
+        decrypt_state_ref(dkeys, encrypted, decrypted);
+        ASSERT_EQ(memcmp(decrypted, data, 16), 0);
+    }
+}
+
+TEST(AES, ttable_state) {
+    unsigned char key[32] = {};
+    unsigned char data[16] = {};
+    for (int i = 0; i < 32; ++i) {
+        key[i] = (unsigned char)(i * 7 + 3);
+    }
+
+    const int key_sizes[] = {16, 24, 32};
+    for (int k = 0; k < 3; ++k) {
+        const RoundKeys keys = expand_key(key, key_sizes[k]);
+        for (int n = 0; n < 64; ++n) {
+            unsigned char ok_encrypted[16], encrypted[16], decrypted[16];
+            encrypt_state_ref(keys, data, ok_encrypted);
+            encrypt_state_ttable(keys, data, encrypted);
+            ASSERT_EQ(memcmp(encrypted, ok_encrypted, 16), 0);
+
+            decrypt_state_ttable(expand_decrypt_key(keys), encrypted, decrypted);
+            ASSERT_EQ(memcmp(decrypted, data, 16), 0);
+
+            memcpy(data, encrypted, 16);
+        }
+    }
+}
+
+#if PLUSAES_HAS_AESNI
+TEST(AES, aesni_state) {
+    if (!has_aesni()) {
+        std::cout << "AES-NI is not available" << std::endl;
+        return;
+    }
+
+    unsigned char key[32] = {};
+    unsigned char data[16] = {};
+    for (int i = 0; i < 32; ++i) {
+        key[i] = (unsigned char)(i * 13 + 5);
+    }
+
+    const int key_sizes[] = {16, 24, 32};
+    for (int k = 0; k < 3; ++k) {
+        const RoundKeys keys = expand_key(key, key_sizes[k]);
+        for (int n = 0; n < 64; ++n) {
+            unsigned char ok_encrypted[16], encrypted[16], decrypted[16];
+            encrypt_state_ttable(keys, data, ok_encrypted);
+            aesni_encrypt_state(keys, data, encrypted);
+            ASSERT_EQ(memcmp(encrypted, ok_encrypted, 16), 0);
+
+            aesni_decrypt_state(expand_decrypt_key(keys), encrypted, decrypted);
+            ASSERT_EQ(memcmp(decrypted, data, 16), 0);
+
+            memcpy(data, encrypted, 16);
+        }
+    }
+}
+
+TEST(AES, vperm_state) {
+    if (!has_ssse3()) {
+        std::cout << "SSSE3 is not available" << std::endl;
+        return;
+    }
+
+    unsigned char key[32] = {};
+    unsigned char data[16] = {};
+    for (int i = 0; i < 32; ++i) {
+        key[i] = (unsigned char)(i * 7 + 3);
+    }
+
+    const int key_sizes[] = {16, 24, 32};
+    for (int k = 0; k < 3; ++k) {
+        const RoundKeys keys = expand_key(key, key_sizes[k]);
+        const RoundKeys dkeys = expand_decrypt_key(keys);
+        for (int n = 0; n < 64; ++n) {
+            unsigned char ok_encrypted[16], encrypted[16], ok_decrypted[16], decrypted[16];
+            encrypt_state_ref(keys, data, ok_encrypted);
+            vp_encrypt_state(keys, data, encrypted);
+            ASSERT_EQ(memcmp(encrypted, ok_encrypted, 16), 0);
+
+            decrypt_state_ref(dkeys, data, ok_decrypted);
+            vp_decrypt_state(dkeys, data, decrypted);
+            ASSERT_EQ(memcmp(decrypted, ok_decrypted, 16), 0);
+
+            memcpy(data, encrypted, 16);
+        }
+    }
+}
+
+TEST(AES, vperm_sub_word) {
+    if (!has_ssse3()) {
+        std::cout << "SSSE3 is not available" << std::endl;
+        return;
+    }
+
+    for (int i = 0; i < 256; ++i) {
+        const Word w = (Word)i | (Word)(i ^ 0x5A) << 8 | (Word)(255 - i) << 16 | (Word)((i * 7) & 0xFF) << 24;
+        ASSERT_EQ(vp_sub_word(w), sub_word(w));
+    }
+}
+#endif
+
+TEST(AES, encrypt_decrypt_blocks) {
+    unsigned char key[32] = {};
+    unsigned char data[20 * 16] = {};
+    for (int i = 0; i < 32; ++i) {
+        key[i] = (unsigned char)(i * 11 + 1);
+    }
+    for (int i = 0; i < (int)sizeof(data); ++i) {
+        data[i] = (unsigned char)(i * 3);
+    }
+
+    const int key_sizes[] = {16, 24, 32};
+    for (int k = 0; k < 3; ++k) {
+        const RoundKeys keys = expand_key(key, key_sizes[k]);
+        const RoundKeys dkeys = expand_decrypt_key(keys);
+        for (std::size_t n = 0; n <= 20; ++n) {
+            unsigned char ok_encrypted[sizeof(data)], encrypted[sizeof(data)], decrypted[sizeof(data)];
+            for (std::size_t i = 0; i < n; ++i) {
+                encrypt_state(keys, data + i * 16, ok_encrypted + i * 16);
+            }
+
+            encrypt_blocks(keys, data, encrypted, n);
+            ASSERT_EQ(memcmp(encrypted, ok_encrypted, n * 16), 0);
+
+            decrypt_blocks(dkeys, encrypted, decrypted, n);
+            ASSERT_EQ(memcmp(decrypted, data, n * 16), 0);
+
+#if PLUSAES_USE_TTABLE
+            encrypt_blocks_ttable(keys, data, encrypted, n);
+            ASSERT_EQ(memcmp(encrypted, ok_encrypted, n * 16), 0);
+
+            decrypt_blocks_ttable(dkeys, encrypted, decrypted, n);
+            ASSERT_EQ(memcmp(decrypted, data, n * 16), 0);
+#endif
+        }
+    }
+}
+
+TEST(AES, bitslice_sub_word) {
+    for (int i = 0; i < 256; ++i) {
+        const Word w = (Word)i | (Word)(i ^ 0x5A) << 8 | (Word)(255 - i) << 16 | (Word)((i * 7) & 0xFF) << 24;
+        ASSERT_EQ(bs_sub_word(w), sub_word(w));
+    }
+}
+
+TEST(AES, bitslice_blocks) {
+    unsigned char key[32] = {};
+    unsigned char data[40 * 16] = {};
+    for (int i = 0; i < 32; ++i) {
+        key[i] = (unsigned char)(i * 17 + 7);
+    }
+    for (int i = 0; i < (int)sizeof(data); ++i) {
+        data[i] = (unsigned char)(i * 5 + i / 16);
+    }
+
+    const int key_sizes[] = {16, 24, 32};
+    for (int k = 0; k < 3; ++k) {
+        const RoundKeys keys = expand_key(key, key_sizes[k]);
+        const RoundKeys dkeys = expand_decrypt_key(keys);
+        for (std::size_t n = 0; n <= 40; ++n) {
+            unsigned char ok_encrypted[sizeof(data)], encrypted[sizeof(data)], decrypted[sizeof(data)];
+            for (std::size_t i = 0; i < n; ++i) {
+                encrypt_state_ref(keys, data + i * 16, ok_encrypted + i * 16);
+            }
+
+            bs_encrypt_blocks_u64(keys, data, encrypted, n);
+            ASSERT_EQ(memcmp(encrypted, ok_encrypted, n * 16), 0);
+            bs_decrypt_blocks_u64(dkeys, encrypted, decrypted, n);
+            ASSERT_EQ(memcmp(decrypted, data, n * 16), 0);
+
+#if PLUSAES_HAS_AESNI
+            if (has_sse2()) {
+                bs_encrypt_blocks_sse2(keys, data, encrypted, n);
+                ASSERT_EQ(memcmp(encrypted, ok_encrypted, n * 16), 0);
+                bs_decrypt_blocks_sse2(dkeys, encrypted, decrypted, n);
+                ASSERT_EQ(memcmp(decrypted, data, n * 16), 0);
+            }
+#endif
+#if PLUSAES_HAS_AVX2
+            if (has_avx2()) {
+                bs_encrypt_blocks_avx2(keys, data, encrypted, n);
+                ASSERT_EQ(memcmp(encrypted, ok_encrypted, n * 16), 0);
+                bs_decrypt_blocks_avx2(dkeys, encrypted, decrypted, n);
+                ASSERT_EQ(memcmp(decrypted, data, n * 16), 0);
+            }
+#endif
+
+            bs_crypt_blocks(keys, data, encrypted, n, true);
+            ASSERT_EQ(memcmp(encrypted, ok_encrypted, n * 16), 0);
+            bs_crypt_blocks(dkeys, encrypted, decrypted, n, false);
+            ASSERT_EQ(memcmp(decrypted, data, n * 16), 0);
+        }
+    }
+}
+
+#if PLUSAES_HAS_VAES
+TEST(AES, vaes_blocks) {
+    unsigned char key[32] = {};
+    unsigned char data[40 * 16] = {};
+    for (int i = 0; i < 32; ++i) {
+        key[i] = (unsigned char)(i * 13 + 5);
+    }
+    for (int i = 0; i < (int)sizeof(data); ++i) {
+        data[i] = (unsigned char)(i * 3 + i / 16);
+    }
+
+    const int key_sizes[] = {16, 24, 32};
+    for (int k = 0; k < 3; ++k) {
+        const RoundKeys keys = expand_key(key, key_sizes[k]);
+        const RoundKeys dkeys = expand_decrypt_key(keys);
+        for (std::size_t n = 0; n <= 40; ++n) {
+            unsigned char ok_encrypted[sizeof(data)], encrypted[sizeof(data)], decrypted[sizeof(data)];
+            for (std::size_t i = 0; i < n; ++i) {
+                encrypt_state_ref(keys, data + i * 16, ok_encrypted + i * 16);
+            }
+
+            if (has_vaes_avx2()) {
+                vaes_avx2_encrypt_blocks(keys, data, encrypted, n);
+                ASSERT_EQ(memcmp(encrypted, ok_encrypted, n * 16), 0);
+                vaes_avx2_decrypt_blocks(dkeys, encrypted, decrypted, n);
+                ASSERT_EQ(memcmp(decrypted, data, n * 16), 0);
+            }
+            if (has_vaes_avx512()) {
+                vaes_avx512_encrypt_blocks(keys, data, encrypted, n);
+                ASSERT_EQ(memcmp(encrypted, ok_encrypted, n * 16), 0);
+                vaes_avx512_decrypt_blocks(dkeys, encrypted, decrypted, n);
+                ASSERT_EQ(memcmp(decrypted, data, n * 16), 0);
+            }
+        }
+    }
+}
+#endif
+
+TEST(AES, backends) {
+    unsigned char key[32] = {};
+    for (int i = 0; i < 32; ++i) {
+        key[i] = (unsigned char)(i * 11 + 3);
+    }
+    const plusaes::KeySchedule key_schedule(key, sizeof(key));
+    const unsigned char iv[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 0xff, 0xff, 0xff, 0xf0};
+    const unsigned long size = 37 * 16;
+    std::vector<unsigned char> data(size);
+    for (unsigned long i = 0; i < size; ++i) {
+        data[i] = (unsigned char)(i * 7);
+    }
+
+    ASSERT_EQ(plusaes::set_backend(plusaes::kBackendReference), plusaes::kErrorOk);
+    ASSERT_EQ(plusaes::active_backend(), plusaes::kBackendReference);
+    std::vector<unsigned char> ok_ecb(size), ok_cbc(size), ok_ctr(data), ok_gcm(data);
+    unsigned char ok_tag[16];
+    ASSERT_EQ(plusaes::encrypt_ecb(&data[0], size, key_schedule, &ok_ecb[0], size, false), plusaes::kErrorOk);
+    ASSERT_EQ(plusaes::encrypt_cbc(&data[0], size, key_schedule, &iv, &ok_cbc[0], size, false), plusaes::kErrorOk);
+    ASSERT_EQ(plusaes::crypt_ctr(&ok_ctr[0], size - 5, key_schedule, iv, sizeof(iv)), plusaes::kErrorOk);
+    ASSERT_EQ(plusaes::encrypt_gcm(&ok_gcm[0], size - 5, 0, 0, key_schedule, iv, 12, ok_tag, sizeof(ok_tag)), plusaes::kErrorOk);
+
+    const plusaes::Backend backends[] = {
+        plusaes::kBackendTTable, plusaes::kBackendBitslice, plusaes::kBackendVperm,
+        plusaes::kBackendAesni, plusaes::kBackendVaes
+    };
+    for (std::size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+        const plusaes::Backend backend = backends[i];
+        EXPECT_EQ(parse_backend(plusaes::backend_name(backend)), backend);
+        if (!plusaes::is_backend_supported(backend)) {
+            EXPECT_EQ(plusaes::set_backend(backend), plusaes::kErrorUnsupportedBackend);
+            EXPECT_EQ(plusaes::active_backend(), plusaes::kBackendReference);
+            continue;
+        }
+        ASSERT_EQ(plusaes::set_backend(backend), plusaes::kErrorOk);
+        ASSERT_EQ(plusaes::active_backend(), backend);
+
+        std::vector<unsigned char> encrypted(size), decrypted(size);
+        ASSERT_EQ(plusaes::encrypt_ecb(&data[0], size, key_schedule, &encrypted[0], size, false), plusaes::kErrorOk);
+        EXPECT_EQ(encrypted, ok_ecb);
+        ASSERT_EQ(plusaes::decrypt_ecb(&encrypted[0], size, key_schedule, &decrypted[0], size, 0), plusaes::kErrorOk);
+        EXPECT_EQ(decrypted, data);
+
+        ASSERT_EQ(plusaes::encrypt_cbc(&data[0], size, key_schedule, &iv, &encrypted[0], size, false), plusaes::kErrorOk);
+        EXPECT_EQ(encrypted, ok_cbc);
+        ASSERT_EQ(plusaes::decrypt_cbc(&encrypted[0], size, key_schedule, &iv, &decrypted[0], size, 0), plusaes::kErrorOk);
+        EXPECT_EQ(decrypted, data);
+
+        // the raw key overloads expand the key with the key schedule of the backend
+        ASSERT_EQ(plusaes::decrypt_ecb(&ok_ecb[0], size, key, sizeof(key), &decrypted[0], size, 0), plusaes::kErrorOk);
+        EXPECT_EQ(decrypted, data);
+
+        std::vector<unsigned char> ctr(data), gcm(data);
+        unsigned char tag[16];
+        ASSERT_EQ(plusaes::crypt_ctr(&ctr[0], size - 5, key_schedule, iv, sizeof(iv)), plusaes::kErrorOk);
+        EXPECT_EQ(ctr, ok_ctr);
+        ASSERT_EQ(plusaes::encrypt_gcm(&gcm[0], size - 5, 0, 0, key_schedule, iv, 12, tag, sizeof(tag)), plusaes::kErrorOk);
+        EXPECT_EQ(gcm, ok_gcm);
+        EXPECT_EQ(memcmp(tag, ok_tag, sizeof(tag)), 0);
+
+        ASSERT_EQ(plusaes::set_backend(plusaes::kBackendReference), plusaes::kErrorOk);
+    }
+
+    EXPECT_EQ(parse_backend("unknown"), plusaes::kBackendAuto);
+    EXPECT_EQ(parse_backend(0), plusaes::kBackendAuto);
+    EXPECT_EQ(plusaes::set_backend(plusaes::kBackendAuto), plusaes::kErrorOk);
+    EXPECT_EQ(plusaes::active_backend(), get_default_backend());
+}
+
+#if __cplusplus >= 201103L
+TEST(AES, set_backend_threads) {
+    unsigned char key[16] = {};
+    for (int i = 0; i < 16; ++i) {
+        key[i] = (unsigned char)(i * 5 + 1);
+    }
+    const plusaes::KeySchedule key_schedule(key, sizeof(key));
+    const unsigned char iv[16] = {7};
+    std::vector<unsigned char> ok(33 * 16, 0x3c);
+    ASSERT_EQ(plusaes::crypt_ctr(&ok[0], (unsigned long)ok.size(), key_schedule, iv, sizeof(iv)), plusaes::kErrorOk);
+
+    // the backend changes while the other threads encrypt, and their results must not
+    std::atomic<bool> stop(false);
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; ++t) {
+        threads.push_back(std::thread([&] {
+            while (!stop.load()) {
+                std::vector<unsigned char> data(ok.size(), 0x3c);
+                plusaes::crypt_ctr(&data[0], (unsigned long)data.size(), key_schedule, iv, sizeof(iv));
+                if (data != ok) {
+                    ++mismatches;
+                }
+            }
+        }));
+    }
+
+    const plusaes::Backend backends[] = {
+        plusaes::kBackendReference, plusaes::kBackendTTable, plusaes::kBackendBitslice,
+        plusaes::kBackendVperm, plusaes::kBackendAesni, plusaes::kBackendVaes, plusaes::kBackendAuto
+    };
+    for (int i = 0; i < 2000; ++i) {
+        plusaes::set_backend(backends[i % (sizeof(backends) / sizeof(backends[0]))]);
+        std::this_thread::yield();
+    }
+    stop = true;
+    for (std::size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+
+    EXPECT_EQ(mismatches.load(), 0);
+    EXPECT_EQ(plusaes::set_backend(plusaes::kBackendAuto), plusaes::kErrorOk);
+}
+#endif
+
 TEST(AES, key_from_string_128) {
     const char key_str[] = "1234567890123456";
     std::vector<unsigned char> key = plusaes::key_from_string(&key_str);
@@ -473,6 +880,164 @@ TEST(AES, encrypt_decrypt_cbc_256_key_not_mul_16_iv) {
     test_encrypt_decrypt_cbc(data, key, &iv, ok_encrypted, true);
 }
 
+TEST(AES, decrypt_cbc_batches) {
+    const std::vector<unsigned char> key = plusaes::key_from_string(&"ABCDEF1234567890");
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+    const unsigned char iv[16] = {0x73, 0xD4, 0xA3, 0x24, 0x73, 0xF4, 0xD6, 0x90, 0xEE, 0xA2, 0x5E, 0xE6, 0xE0, 0x9F, 0xF5, 0x49};
+
+    const unsigned long sizes[] = {16 * 63, 16 * 64 + 5, 16 * 65, 16 * 200 + 15};
+    for (int n = 0; n < 4; ++n) {
+        std::vector<unsigned char> data(sizes[n]);
+        for (unsigned long i = 0; i < data.size(); ++i) {
+            data[i] = (unsigned char)(i * 7);
+        }
+
+        const unsigned long encrypted_size = plusaes::get_padded_encrypted_size((unsigned long)data.size());
+        std::vector<unsigned char> encrypted(encrypted_size), decrypted(encrypted_size);
+        ASSERT_EQ(plusaes::encrypt_cbc(&data[0], (unsigned long)data.size(), key_schedule, &iv, &encrypted[0], encrypted_size, true), plusaes::kErrorOk);
+
+        // chain block by block
+        unsigned char prev[16];
+        memcpy(prev, iv, 16);
+        for (unsigned long i = 0; i + 16 < encrypted_size; i += 16) {
+            unsigned char blk[16];
+            decrypt_state(key_schedule.decrypt_round_keys(), &encrypted[i], blk);
+            xor_data(blk, prev);
+            ASSERT_EQ(memcmp(blk, &data[i], 16), 0);
+            memcpy(prev, &encrypted[i], 16);
+        }
+
+        unsigned long padded = 0;
+        ASSERT_EQ(plusaes::decrypt_cbc(&encrypted[0], encrypted_size, key_schedule, &iv, &decrypted[0], encrypted_size, &padded), plusaes::kErrorOk);
+        ASSERT_EQ(encrypted_size - padded, data.size());
+        ASSERT_EQ(memcmp(&decrypted[0], &data[0], data.size()), 0);
+    }
+}
+
+// Key schedule
+
+TEST(AES, key_schedule_ecb_cbc) {
+    const std::vector<unsigned char> key = plusaes::key_from_string(&"ABCDEF1234567890@:;:+{}^sas<^->/");
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+    ASSERT_TRUE(key_schedule.is_valid());
+    ASSERT_EQ(key_schedule.key_size(), 32UL);
+
+    const std::string data =
+        "1,2,3,4,5,6,7,8\n"
+        "asbcdeftgteuwio\n"
+        "1234567890123456"
+        "@<>";
+    const unsigned char iv[16] = {0xB7, 0xA6, 0xCE, 0xF6, 0xFE, 0x3F, 0xE2, 0x83, 0xC1, 0xC9, 0xD3, 0x2F, 0xFF, 0xAC, 0x47, 0xC4};
+    const unsigned long encrypted_size = plusaes::get_padded_encrypted_size((unsigned long)data.size());
+
+    std::vector<unsigned char> ok_encrypted(encrypted_size), encrypted(encrypted_size), decrypted(encrypted_size);
+    unsigned long padded = 0;
+
+    // ECB
+    plusaes::encrypt_ecb((unsigned char*)data.data(), (unsigned long)data.size(), &key[0], (unsigned long)key.size(), &ok_encrypted[0], encrypted_size, true);
+    ASSERT_EQ(plusaes::encrypt_ecb((unsigned char*)data.data(), (unsigned long)data.size(), key_schedule, &encrypted[0], encrypted_size, true), plusaes::kErrorOk);
+    ASSERT_EQ(memcmp(&encrypted[0], &ok_encrypted[0], encrypted_size), 0);
+    ASSERT_EQ(plusaes::decrypt_ecb(&encrypted[0], encrypted_size, key_schedule, &decrypted[0], encrypted_size, &padded), plusaes::kErrorOk);
+    ASSERT_EQ(std::string(decrypted.begin(), decrypted.end() - padded), data);
+
+    // CBC
+    plusaes::encrypt_cbc((unsigned char*)data.data(), (unsigned long)data.size(), &key[0], (unsigned long)key.size(), &iv, &ok_encrypted[0], encrypted_size, true);
+    ASSERT_EQ(plusaes::encrypt_cbc((unsigned char*)data.data(), (unsigned long)data.size(), key_schedule, &iv, &encrypted[0], encrypted_size, true), plusaes::kErrorOk);
+    ASSERT_EQ(memcmp(&encrypted[0], &ok_encrypted[0], encrypted_size), 0);
+    ASSERT_EQ(plusaes::decrypt_cbc(&encrypted[0], encrypted_size, key_schedule, &iv, &decrypted[0], encrypted_size, &padded), plusaes::kErrorOk);
+    ASSERT_EQ(std::string(decrypted.begin(), decrypted.end() - padded), data);
+}
+
+TEST(AES, key_schedule_invalid) {
+    const unsigned char key[14] = {};
+    plusaes::KeySchedule key_schedule;
+    ASSERT_FALSE(key_schedule.is_valid());
+    ASSERT_EQ(key_schedule.set_key(key, sizeof(key)), plusaes::kErrorInvalidKeySize);
+    ASSERT_FALSE(key_schedule.is_valid());
+
+    const std::string data = "0123456789ABCDEF";
+    unsigned char encrypted[32] = {};
+    unsigned long padding = 0;
+
+    ASSERT_EQ(plusaes::encrypt_ecb((unsigned char*)data.data(), (unsigned long)data.size(), key_schedule, encrypted, sizeof(encrypted), true), plusaes::kErrorInvalidKeySize);
+    ASSERT_EQ(plusaes::decrypt_cbc(encrypted, sizeof(encrypted), key_schedule, 0, encrypted, sizeof(encrypted), &padding), plusaes::kErrorInvalidKeySize);
+}
+
+// Streaming
+
+TEST(AES, block_stream) {
+    const std::vector<unsigned char> key = plusaes::key_from_string(&"ABCDEF1234567890");
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+    const unsigned char iv[16] = {0xB7, 0xA6, 0xCE, 0xF6, 0xFE, 0x3F, 0xE2, 0x83, 0xC1, 0xC9, 0xD3, 0x2F, 0xFF, 0xAC, 0x47, 0xC4};
+
+    for (unsigned long size = 1; size < 300; size += 11) {
+        std::vector<unsigned char> data(size);
+        for (unsigned long i = 0; i < size; ++i) {
+            data[i] = (unsigned char)(i * 7);
+        }
+        const unsigned long padded_size = plusaes::get_padded_encrypted_size(size);
+        std::vector<unsigned char> ok_encrypted(padded_size);
+        plusaes::Error e;
+
+        // with padding
+        plusaes::encrypt_ecb(&data[0], size, key_schedule, &ok_encrypted[0], padded_size, true);
+        plusaes::EcbEncryptor ecb_enc(key_schedule, true);
+        ASSERT_EQ(run_block_stream(ecb_enc, data, &e), ok_encrypted);
+        ASSERT_EQ(e, plusaes::kErrorOk);
+        plusaes::EcbDecryptor ecb_dec(key_schedule, true);
+        ASSERT_EQ(run_block_stream(ecb_dec, ok_encrypted, &e), data);
+        ASSERT_EQ(e, plusaes::kErrorOk);
+
+        plusaes::encrypt_cbc(&data[0], size, key_schedule, &iv, &ok_encrypted[0], padded_size, true);
+        plusaes::CbcEncryptor cbc_enc(key_schedule, &iv, true);
+        ASSERT_EQ(run_block_stream(cbc_enc, data, &e), ok_encrypted);
+        ASSERT_EQ(e, plusaes::kErrorOk);
+        plusaes::CbcDecryptor cbc_dec(key_schedule, &iv, true);
+        ASSERT_EQ(run_block_stream(cbc_dec, ok_encrypted, &e), data);
+        ASSERT_EQ(e, plusaes::kErrorOk);
+
+        // without padding
+        data.resize(size / 16 * 16);
+        ok_encrypted.resize(data.size());
+        if (data.empty()) {
+            continue;
+        }
+        plusaes::encrypt_cbc(&data[0], (unsigned long)data.size(), key_schedule, NULL, &ok_encrypted[0], (unsigned long)data.size(), false);
+        plusaes::CbcEncryptor cbc_enc_np(key_schedule, NULL, false);
+        ASSERT_EQ(run_block_stream(cbc_enc_np, data, &e), ok_encrypted);
+        ASSERT_EQ(e, plusaes::kErrorOk);
+        plusaes::CbcDecryptor cbc_dec_np(key_schedule, NULL, false);
+        ASSERT_EQ(run_block_stream(cbc_dec_np, ok_encrypted, &e), data);
+        ASSERT_EQ(e, plusaes::kErrorOk);
+    }
+}
+
+TEST(AES, block_stream_invalid) {
+    const std::vector<unsigned char> key = plusaes::key_from_string(&"ABCDEF1234567890");
+    const plusaes::KeySchedule key_schedule(&key[0], (unsigned long)key.size());
+    unsigned char data[32] = {};
+    unsigned char out[32] = {};
+    unsigned long written = 0;
+
+    plusaes::EcbEncryptor invalid_key(plusaes::KeySchedule(), true);
+    ASSERT_EQ(invalid_key.update(data, 16, out, sizeof(out), &written), plusaes::kErrorInvalidKeySize);
+
+    plusaes::EcbEncryptor enc(key_schedule, false);
+    ASSERT_EQ(enc.update(data, 32, out, 16, &written), plusaes::kErrorInvalidBufferSize);
+    ASSERT_EQ(enc.update(data, 20, out, sizeof(out), &written), plusaes::kErrorOk);
+    ASSERT_EQ(written, 16UL);
+    ASSERT_EQ(enc.finalize(out, sizeof(out), &written), plusaes::kErrorInvalidDataSize);
+
+    plusaes::CbcDecryptor dec(key_schedule, NULL, true);
+    ASSERT_EQ(dec.update(data, 16, out, sizeof(out), &written), plusaes::kErrorOk);
+    ASSERT_EQ(written, 0UL);
+    ASSERT_EQ(dec.finalize(out, sizeof(out), &written), plusaes::kErrorInvalidKey);
+
+    plusaes::CbcDecryptor dec_short(key_schedule, NULL, true);
+    ASSERT_EQ(dec_short.update(data, 10, out, sizeof(out), &written), plusaes::kErrorOk);
+    ASSERT_EQ(dec_short.finalize(out, sizeof(out), &written), plusaes::kErrorInvalidDataSize);
+}
+
 // Invalid
 
 TEST(AES, invalid_key_size) {